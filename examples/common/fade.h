@@ -0,0 +1,103 @@
+// Gamma-corrected linear fades, stepped from an interrupt at PWM rate.
+//
+// Intensities are perceptual levels 0..255.  fade_to() starts a ramp to
+// a new level over some number of ticks; fade_tick() advances it by one
+// and returns the gamma-corrected output as a 16-bit duty cycle, for
+// 16-bit PWM (e.g. XMEGA timers) as-is or for 8-bit PWM through
+// fade_dither8().
+//
+// The gamma curve is a generated header (avr_gamma_header in the shake
+// script), which must be included before this file.  It's interpolated
+// with two 8x8 multiplies, so it's cheap on parts without MUL too.
+//
+// fade_to() and fade_tick() on the same channel must not interrupt
+// each other.
+
+#ifndef FADE_H
+#define FADE_H
+
+#include <avr/pgmspace.h>
+
+#include <stdint.h>
+
+#if !defined(GAMMA_BITS) || GAMMA_BITS > 16
+#error "include a generated gamma header (16 bits or less) before fade.h"
+#endif
+
+struct fade {
+    uint16_t level;     // current intensity, 8.8 fixed point
+    uint16_t step;      // change per tick, rounded down...
+    uint8_t  rem;       // ... with this remainder (in 1/length units)
+    uint8_t  acc;       // remainders not yet added to 'level'
+    uint8_t  length;    // of the ramp, in ticks
+    uint8_t  down;
+    uint8_t  target;
+    uint8_t  ticks;     // ticks left in the ramp
+    uint8_t  error;     // dither accumulator
+};
+
+// ramp from the current level to 'target' over 'ticks' ticks (0 or 1
+// means jump there on the next tick)
+static inline void fade_to(struct fade *f, uint8_t target, uint8_t ticks) {
+    uint16_t goal = (uint16_t) target << 8;
+    uint16_t diff;
+
+    f->down     = goal < f->level;
+    diff        = f->down ? f->level - goal : goal - f->level;
+    f->ticks    = ticks ? ticks : 1;
+    f->length   = f->ticks;
+    f->step     = diff / f->ticks;
+    f->rem      = diff % f->ticks;
+    f->acc      = 0;
+    f->target   = target;
+}
+
+// linear interpolation of gamma_table (33 entries), with a 5-bit index
+// and 8-bit fraction: 'level' * 8192 / 0xFF00, near enough (exact at
+// both ends, and never 2/256 of a segment out in between)
+static inline uint16_t fade_gamma(uint16_t level) {
+    uint16_t pos    = (level >> 3) + (level >> 11) + (level >> 15);
+    uint8_t  i      = pos >> 8;
+    uint8_t  frac   = pos;
+
+    if (i == 32) return pgm_read_word(&gamma_table[32]);
+
+    uint16_t lo     = pgm_read_word(&gamma_table[i]);
+    uint16_t d      = pgm_read_word(&gamma_table[i + 1]) - lo;
+
+    // lo + d * frac / 256, exactly, as two 8x8 multiplies
+    return lo + (d >> 8) * frac + ((uint16_t) (uint8_t) d * frac >> 8);
+}
+
+static inline uint16_t fade_tick(struct fade *f) {
+    if (f->ticks) {
+        if (--f->ticks) {
+            // Bresenham: the remainders add up to one more unit every
+            // length/rem ticks
+            uint16_t step = f->step;
+            if (f->acc >= f->length - f->rem) {
+                f->acc -= f->length - f->rem;
+                step++;
+            } else {
+                f->acc += f->rem;
+            }
+            f->level = f->down ? f->level - step : f->level + step;
+        } else {
+            f->level = (uint16_t) f->target << 8;
+        }
+    }
+    return fade_gamma(f->level) << (16 - GAMMA_BITS);
+}
+
+// reduce a 16-bit duty cycle to 8 bits, carrying the low byte over
+// from tick to tick (error diffusion) so the average is still right
+static inline uint8_t fade_dither8(struct fade *f, uint16_t x) {
+    uint8_t out = x >> 8;
+    uint8_t e   = f->error + (uint8_t) x;
+
+    if (e < f->error && out != 0xff) out++;
+    f->error = e;
+    return out;
+}
+
+#endif
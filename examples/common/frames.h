@@ -0,0 +1,154 @@
+// Frame scheduler for the LED examples.  An interrupt calls frame_step()
+// FRAME_STEPS times per frame, and the main loop sleeps in frames_wait()
+// until a frame is finished, so the CPU is only awake to do the per-step
+// work in the ISR and to prepare the next frame.  Every step is a
+// wakeup: FRAME_STEPS per frame from the watchdog, FRAME_STEPS *
+// FRAME_TICKS from timer 0.
+//
+// Configure with (before including this file):
+//
+//  FRAME_SOURCE    FRAME_WDT: the watchdog interrupt, one step every
+//                  16ms << FRAME_WDT_PRESCALE (0..9).  Its oscillator
+//                  is not very precise (and varies with supply
+//                  voltage), but the timer0 PWM doesn't have to run
+//                  any faster than it looks good.
+//                  FRAME_TIMER0: one step every FRAME_TICKS timer 0
+//                  overflows (1..256), for when frames have to be
+//                  faster or more precise than the watchdog allows.
+//                  Timer 0 must already be running.
+//  FRAME_STEPS     steps per frame (default 1)
+//  FRAME_TRACE     (simulation builds) drive PB4 high from each wakeup
+//                  until the CPU next sleeps, and toggle PB3 at the end
+//                  of each frame, for "shake sleep" in the flicker
+//                  examples to count wakeups and active cycles from.
+//                  Both pins have to be free.
+//
+// and define frame_step(), which is called from the ISR once per step.
+// frames_wait() returns just after a frame's last step, which is the
+// time to hand the ISR whatever the next frame needs.
+//
+// The CPU idles between interrupts: idle is the deepest sleep mode that
+// keeps clkIO, and so the PWM, running.  frames_init() also turns off
+// the ADC and analog comparator, which nothing here uses.
+
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+
+#include <stdint.h>
+
+#define FRAME_WDT       0
+#define FRAME_TIMER0    1
+
+#ifndef FRAME_SOURCE
+#define FRAME_SOURCE FRAME_WDT
+#endif
+
+#ifndef FRAME_STEPS
+#define FRAME_STEPS 1
+#endif
+
+#ifndef FRAME_WDT_PRESCALE
+#define FRAME_WDT_PRESCALE 0
+#endif
+
+#ifndef WDTCSR
+#define WDTCSR WDTCR
+#endif
+#ifndef WDTIE
+#define WDTIE WDIE
+#endif
+
+#ifdef FRAME_TRACE
+#define FRAME_TRACE_WAKE()  (PORTB |= 1 << PB4)
+#define FRAME_TRACE_SLEEP() (PORTB &= ~(1 << PB4))
+#define FRAME_TRACE_FRAME() (PORTB ^= 1 << PB3)
+#else
+#define FRAME_TRACE_WAKE()
+#define FRAME_TRACE_SLEEP()
+#define FRAME_TRACE_FRAME()
+#endif
+
+static void frame_step();
+
+// incremented at the end of every frame
+static volatile uint8_t frame_count = 0;
+
+static inline void frame_tick() {
+    static uint8_t step = 0;
+
+    frame_step();
+    if (++step >= FRAME_STEPS) {
+        step = 0;
+        frame_count++;
+        FRAME_TRACE_FRAME();
+    }
+}
+
+#if FRAME_SOURCE == FRAME_WDT
+
+ISR(WDT_vect) {
+    FRAME_TRACE_WAKE();
+    frame_tick();
+}
+
+#else
+
+ISR(TIM0_OVF_vect) {
+    static uint8_t ticks = 0;
+    FRAME_TRACE_WAKE();
+    if (++ticks >= FRAME_TICKS) {
+        ticks = 0;
+        frame_tick();
+    }
+}
+
+#endif
+
+static void frames_init() {
+#ifdef PRR
+    PRR |= 1 << PRADC;
+#endif
+    ACSR |= 1 << ACD;
+    set_sleep_mode(SLEEP_MODE_IDLE);
+#ifdef FRAME_TRACE
+    DDRB |= 1 << DDB4 | 1 << DDB3;
+    FRAME_TRACE_WAKE();
+#endif
+
+#if FRAME_SOURCE == FRAME_WDT
+    // interrupt mode, no reset; changing the prescaler takes the timed
+    // sequence whether or not the watchdog is enabled
+    cli();
+    WDTCSR  = (1 << WDCE) | (1 << WDE);
+    WDTCSR  = (1 << WDTIE)
+            | ((FRAME_WDT_PRESCALE & 8) ? 1 << WDP3 : 0)
+            | (FRAME_WDT_PRESCALE & 7) << WDP0;
+#else
+    TIMSK0 |= 1 << TOIE0;
+#endif
+    sei();
+}
+
+// sleep until the end of the current frame
+static void frames_wait() {
+    uint8_t seen = frame_count;
+
+    // interrupts stay off between the check and the sleep, so the wakeup
+    // can't slip in between them (sei takes effect after sleep starts)
+    cli();
+    while (frame_count == seen) {
+        sleep_enable();
+        FRAME_TRACE_SLEEP();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        cli();
+    }
+    sei();
+}
+
+#endif
@@ -0,0 +1,248 @@
+// Small PRNGs for the LED examples, sharing one interface:
+// 
+//  prng_seed(seed)     seed the generator (any value; 0 is fixed up)
+//  rand(bits)          return 'bits' (1..8) fresh random bits
+// 
+// Select an engine with -DPRNG_ENGINE=... before including this file.
+// The three LFSR32 engines produce exactly the same sequence as the
+// original bit-at-a-time LFSR, so they can be swapped freely; they
+// only trade flash for speed:
+// 
+//  PRNG_LFSR32         1 bit per step, no tables
+//  PRNG_LFSR32_NIBBLE  4 bits per step, 80 bytes of tables
+//  PRNG_LFSR32_BYTE    8 bits per step, 1.3 KiB of tables (also uses
+//                      the nibble tables for leftover bits)
+// 
+// The others are different generators:
+// 
+//  PRNG_XORSHIFT32     Marsaglia's xorshift (13, 17, 5): a whole word
+//                      per step, so rand(1) costs as much as rand(8).
+//  PRNG_LFSR16         16-bit Galois LFSR (taps 16, 14, 13, 11), 1 bit
+//                      per step; much cheaper per step than LFSR32 on
+//                      an 8-bit core, but with a period of only 65535.
+// 
+// The default is the fastest LFSR32 engine whose tables comfortably fit
+// the part's flash.
+// 
+// In this directory, "shake test" checks the LFSR32 engines against a
+// reference LFSR on the host (test/prng_test.c), and "shake bench"
+// counts each engine's cycles per call under simavr (test/bench.c).
+
+#ifndef PRNG_H
+#define PRNG_H
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include <stdint.h>
+
+#define PRNG_LFSR32         0
+#define PRNG_LFSR32_NIBBLE  1
+#define PRNG_LFSR32_BYTE    2
+#define PRNG_XORSHIFT32     3
+#define PRNG_LFSR16         4
+
+#ifndef PRNG_ENGINE
+#if FLASHEND >= 0x3FFF
+#define PRNG_ENGINE PRNG_LFSR32_BYTE
+#elif FLASHEND >= 0x7FF
+#define PRNG_ENGINE PRNG_LFSR32_NIBBLE
+#else
+#define PRNG_ENGINE PRNG_LFSR32
+#endif
+#endif
+
+#if PRNG_ENGINE == PRNG_LFSR16
+
+#define POLY 0xB400u
+static uint16_t lfsr = 1;
+
+static inline void prng_seed(uint32_t seed) {
+    lfsr = seed ^ (seed >> 16);
+    if (!lfsr) lfsr = 1;
+}
+
+static inline uint8_t rand(uint8_t bits) {
+    uint8_t x = 0;
+    uint8_t i;
+    
+    for (i = 0; i < bits; i++) {
+        x <<= 1;
+        lfsr = (lfsr >> 1) ^ (-(lfsr & 1u) & POLY);
+        x |= lfsr & 1;
+    }
+    
+    return x;
+}
+
+#elif PRNG_ENGINE == PRNG_XORSHIFT32
+
+static uint32_t lfsr = 1;
+
+static inline void prng_seed(uint32_t seed) {
+    lfsr = seed ? seed : 1;
+}
+
+static inline uint8_t rand(uint8_t bits) {
+    lfsr ^= lfsr << 13;
+    lfsr ^= lfsr >> 17;
+    lfsr ^= lfsr << 5;
+    return lfsr & ((1u << bits) - 1);
+}
+
+#else
+
+// 32-bit Galois LFSR (shifting right), one output bit per step: the
+// new low bit of the state.
+#define POLY 0xA3AC183Cul
+static uint32_t lfsr = 1;
+
+static inline void prng_seed(uint32_t seed) {
+    lfsr = seed ? seed : 1;
+}
+
+static inline uint8_t prng_step1() {
+    lfsr = (lfsr >> 1) ^ (-(lfsr & 1ul) & POLY);
+    return lfsr & 1;
+}
+
+#if PRNG_ENGINE != PRNG_LFSR32
+
+// The LFSR is linear and its low bits only reach the rest of the state
+// through the feedback, so n steps can be done at once:
+// 
+//  state' = (state >> n) ^ next[state & (2^n - 1)]
+// 
+// where next[i] is the state reached from i in n steps.  The first n-1
+// output bits also only depend on the low n bits (out[i], first bit
+// highest); the last one is the new low bit of the state.
+static const uint32_t prng_next4[16] PROGMEM = {
+    0x00000000ul, 0xB7D99B3Bul, 0x28EB060Ful, 0x9F329D34ul,
+    0x51D60C1Eul, 0xE60F9725ul, 0x793D0A11ul, 0xCEE4912Aul,
+    0xA3AC183Cul, 0x14758307ul, 0x8B471E33ul, 0x3C9E8508ul,
+    0xF27A1422ul, 0x45A38F19ul, 0xDA91122Dul, 0x6D488916ul,
+};
+static const uint8_t prng_out4[16] PROGMEM = {
+    0x00, 0x01, 0x04, 0x05, 0x02, 0x03, 0x06, 0x07, 0x01, 0x00, 0x05, 0x04, 0x03, 0x02, 0x07, 0x06,
+};
+
+static inline uint8_t prng_step4() {
+    uint8_t lo = lfsr & 0x0f;
+    lfsr = (lfsr >> 4) ^ pgm_read_dword(&prng_next4[lo]);
+    return pgm_read_byte(&prng_out4[lo]) << 1 | (lfsr & 1);
+}
+
+#endif
+
+#if PRNG_ENGINE == PRNG_LFSR32_BYTE
+
+static const uint32_t prng_next8[256] PROGMEM = {
+    0x00000000ul, 0x37E31CBBul, 0x6FC63976ul, 0x582525CDul,
+    0xDF8C72ECul, 0xE86F6E57ul, 0xB04A4B9Aul, 0x87A95721ul,
+    0xF840D5A1ul, 0xCFA3C91Aul, 0x9786ECD7ul, 0xA065F06Cul,
+    0x27CCA74Dul, 0x102FBBF6ul, 0x480A9E3Bul, 0x7FE98280ul,
+    0xB7D99B3Bul, 0x803A8780ul, 0xD81FA24Dul, 0xEFFCBEF6ul,
+    0x6855E9D7ul, 0x5FB6F56Cul, 0x0793D0A1ul, 0x3070CC1Aul,
+    0x4F994E9Aul, 0x787A5221ul, 0x205F77ECul, 0x17BC6B57ul,
+    0x90153C76ul, 0xA7F620CDul, 0xFFD30500ul, 0xC83019BBul,
+    0x28EB060Ful, 0x1F081AB4ul, 0x472D3F79ul, 0x70CE23C2ul,
+    0xF76774E3ul, 0xC0846858ul, 0x98A14D95ul, 0xAF42512Eul,
+    0xD0ABD3AEul, 0xE748CF15ul, 0xBF6DEAD8ul, 0x888EF663ul,
+    0x0F27A142ul, 0x38C4BDF9ul, 0x60E19834ul, 0x5702848Ful,
+    0x9F329D34ul, 0xA8D1818Ful, 0xF0F4A442ul, 0xC717B8F9ul,
+    0x40BEEFD8ul, 0x775DF363ul, 0x2F78D6AEul, 0x189BCA15ul,
+    0x67724895ul, 0x5091542Eul, 0x08B471E3ul, 0x3F576D58ul,
+    0xB8FE3A79ul, 0x8F1D26C2ul, 0xD738030Ful, 0xE0DB1FB4ul,
+    0x51D60C1Eul, 0x663510A5ul, 0x3E103568ul, 0x09F329D3ul,
+    0x8E5A7EF2ul, 0xB9B96249ul, 0xE19C4784ul, 0xD67F5B3Ful,
+    0xA996D9BFul, 0x9E75C504ul, 0xC650E0C9ul, 0xF1B3FC72ul,
+    0x761AAB53ul, 0x41F9B7E8ul, 0x19DC9225ul, 0x2E3F8E9Eul,
+    0xE60F9725ul, 0xD1EC8B9Eul, 0x89C9AE53ul, 0xBE2AB2E8ul,
+    0x3983E5C9ul, 0x0E60F972ul, 0x5645DCBFul, 0x61A6C004ul,
+    0x1E4F4284ul, 0x29AC5E3Ful, 0x71897BF2ul, 0x466A6749ul,
+    0xC1C33068ul, 0xF6202CD3ul, 0xAE05091Eul, 0x99E615A5ul,
+    0x793D0A11ul, 0x4EDE16AAul, 0x16FB3367ul, 0x21182FDCul,
+    0xA6B178FDul, 0x91526446ul, 0xC977418Bul, 0xFE945D30ul,
+    0x817DDFB0ul, 0xB69EC30Bul, 0xEEBBE6C6ul, 0xD958FA7Dul,
+    0x5EF1AD5Cul, 0x6912B1E7ul, 0x3137942Aul, 0x06D48891ul,
+    0xCEE4912Aul, 0xF9078D91ul, 0xA122A85Cul, 0x96C1B4E7ul,
+    0x1168E3C6ul, 0x268BFF7Dul, 0x7EAEDAB0ul, 0x494DC60Bul,
+    0x36A4448Bul, 0x01475830ul, 0x59627DFDul, 0x6E816146ul,
+    0xE9283667ul, 0xDECB2ADCul, 0x86EE0F11ul, 0xB10D13AAul,
+    0xA3AC183Cul, 0x944F0487ul, 0xCC6A214Aul, 0xFB893DF1ul,
+    0x7C206AD0ul, 0x4BC3766Bul, 0x13E653A6ul, 0x24054F1Dul,
+    0x5BECCD9Dul, 0x6C0FD126ul, 0x342AF4EBul, 0x03C9E850ul,
+    0x8460BF71ul, 0xB383A3CAul, 0xEBA68607ul, 0xDC459ABCul,
+    0x14758307ul, 0x23969FBCul, 0x7BB3BA71ul, 0x4C50A6CAul,
+    0xCBF9F1EBul, 0xFC1AED50ul, 0xA43FC89Dul, 0x93DCD426ul,
+    0xEC3556A6ul, 0xDBD64A1Dul, 0x83F36FD0ul, 0xB410736Bul,
+    0x33B9244Aul, 0x045A38F1ul, 0x5C7F1D3Cul, 0x6B9C0187ul,
+    0x8B471E33ul, 0xBCA40288ul, 0xE4812745ul, 0xD3623BFEul,
+    0x54CB6CDFul, 0x63287064ul, 0x3B0D55A9ul, 0x0CEE4912ul,
+    0x7307CB92ul, 0x44E4D729ul, 0x1CC1F2E4ul, 0x2B22EE5Ful,
+    0xAC8BB97Eul, 0x9B68A5C5ul, 0xC34D8008ul, 0xF4AE9CB3ul,
+    0x3C9E8508ul, 0x0B7D99B3ul, 0x5358BC7Eul, 0x64BBA0C5ul,
+    0xE312F7E4ul, 0xD4F1EB5Ful, 0x8CD4CE92ul, 0xBB37D229ul,
+    0xC4DE50A9ul, 0xF33D4C12ul, 0xAB1869DFul, 0x9CFB7564ul,
+    0x1B522245ul, 0x2CB13EFEul, 0x74941B33ul, 0x43770788ul,
+    0xF27A1422ul, 0xC5990899ul, 0x9DBC2D54ul, 0xAA5F31EFul,
+    0x2DF666CEul, 0x1A157A75ul, 0x42305FB8ul, 0x75D34303ul,
+    0x0A3AC183ul, 0x3DD9DD38ul, 0x65FCF8F5ul, 0x521FE44Eul,
+    0xD5B6B36Ful, 0xE255AFD4ul, 0xBA708A19ul, 0x8D9396A2ul,
+    0x45A38F19ul, 0x724093A2ul, 0x2A65B66Ful, 0x1D86AAD4ul,
+    0x9A2FFDF5ul, 0xADCCE14Eul, 0xF5E9C483ul, 0xC20AD838ul,
+    0xBDE35AB8ul, 0x8A004603ul, 0xD22563CEul, 0xE5C67F75ul,
+    0x626F2854ul, 0x558C34EFul, 0x0DA91122ul, 0x3A4A0D99ul,
+    0xDA91122Dul, 0xED720E96ul, 0xB5572B5Bul, 0x82B437E0ul,
+    0x051D60C1ul, 0x32FE7C7Aul, 0x6ADB59B7ul, 0x5D38450Cul,
+    0x22D1C78Cul, 0x1532DB37ul, 0x4D17FEFAul, 0x7AF4E241ul,
+    0xFD5DB560ul, 0xCABEA9DBul, 0x929B8C16ul, 0xA57890ADul,
+    0x6D488916ul, 0x5AAB95ADul, 0x028EB060ul, 0x356DACDBul,
+    0xB2C4FBFAul, 0x8527E741ul, 0xDD02C28Cul, 0xEAE1DE37ul,
+    0x95085CB7ul, 0xA2EB400Cul, 0xFACE65C1ul, 0xCD2D797Aul,
+    0x4A842E5Bul, 0x7D6732E0ul, 0x2542172Dul, 0x12A10B96ul,
+};
+static const uint8_t prng_out8[256] PROGMEM = {
+    0x00, 0x1C, 0x4E, 0x52, 0x27, 0x3B, 0x69, 0x75, 0x13, 0x0F, 0x5D, 0x41, 0x34, 0x28, 0x7A, 0x66,
+    0x09, 0x15, 0x47, 0x5B, 0x2E, 0x32, 0x60, 0x7C, 0x1A, 0x06, 0x54, 0x48, 0x3D, 0x21, 0x73, 0x6F,
+    0x04, 0x18, 0x4A, 0x56, 0x23, 0x3F, 0x6D, 0x71, 0x17, 0x0B, 0x59, 0x45, 0x30, 0x2C, 0x7E, 0x62,
+    0x0D, 0x11, 0x43, 0x5F, 0x2A, 0x36, 0x64, 0x78, 0x1E, 0x02, 0x50, 0x4C, 0x39, 0x25, 0x77, 0x6B,
+    0x02, 0x1E, 0x4C, 0x50, 0x25, 0x39, 0x6B, 0x77, 0x11, 0x0D, 0x5F, 0x43, 0x36, 0x2A, 0x78, 0x64,
+    0x0B, 0x17, 0x45, 0x59, 0x2C, 0x30, 0x62, 0x7E, 0x18, 0x04, 0x56, 0x4A, 0x3F, 0x23, 0x71, 0x6D,
+    0x06, 0x1A, 0x48, 0x54, 0x21, 0x3D, 0x6F, 0x73, 0x15, 0x09, 0x5B, 0x47, 0x32, 0x2E, 0x7C, 0x60,
+    0x0F, 0x13, 0x41, 0x5D, 0x28, 0x34, 0x66, 0x7A, 0x1C, 0x00, 0x52, 0x4E, 0x3B, 0x27, 0x75, 0x69,
+    0x01, 0x1D, 0x4F, 0x53, 0x26, 0x3A, 0x68, 0x74, 0x12, 0x0E, 0x5C, 0x40, 0x35, 0x29, 0x7B, 0x67,
+    0x08, 0x14, 0x46, 0x5A, 0x2F, 0x33, 0x61, 0x7D, 0x1B, 0x07, 0x55, 0x49, 0x3C, 0x20, 0x72, 0x6E,
+    0x05, 0x19, 0x4B, 0x57, 0x22, 0x3E, 0x6C, 0x70, 0x16, 0x0A, 0x58, 0x44, 0x31, 0x2D, 0x7F, 0x63,
+    0x0C, 0x10, 0x42, 0x5E, 0x2B, 0x37, 0x65, 0x79, 0x1F, 0x03, 0x51, 0x4D, 0x38, 0x24, 0x76, 0x6A,
+    0x03, 0x1F, 0x4D, 0x51, 0x24, 0x38, 0x6A, 0x76, 0x10, 0x0C, 0x5E, 0x42, 0x37, 0x2B, 0x79, 0x65,
+    0x0A, 0x16, 0x44, 0x58, 0x2D, 0x31, 0x63, 0x7F, 0x19, 0x05, 0x57, 0x4B, 0x3E, 0x22, 0x70, 0x6C,
+    0x07, 0x1B, 0x49, 0x55, 0x20, 0x3C, 0x6E, 0x72, 0x14, 0x08, 0x5A, 0x46, 0x33, 0x2F, 0x7D, 0x61,
+    0x0E, 0x12, 0x40, 0x5C, 0x29, 0x35, 0x67, 0x7B, 0x1D, 0x01, 0x53, 0x4F, 0x3A, 0x26, 0x74, 0x68,
+};
+
+static inline uint8_t prng_step8() {
+    uint8_t lo = lfsr;
+    lfsr = (lfsr >> 8) ^ pgm_read_dword(&prng_next8[lo]);
+    return pgm_read_byte(&prng_out8[lo]) << 1 | (lfsr & 1);
+}
+
+#endif
+
+static inline uint8_t rand(uint8_t bits) {
+    uint8_t x = 0;
+    
+#if PRNG_ENGINE == PRNG_LFSR32_BYTE
+    if (bits == 8) return prng_step8();
+#endif
+#if PRNG_ENGINE != PRNG_LFSR32
+    for (; bits >= 4; bits -= 4) x = x << 4 | prng_step4();
+#endif
+    for (; bits; bits--) x = x << 1 | prng_step1();
+    
+    return x;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+// Wear-leveled PRNG seed storage in EEPROM, after Atmel's AVR101: a
+// ring of slots, each a 4-byte seed and a sequence byte.  Every boot
+// writes the next slot with the previous slot's sequence number + 1,
+// so the newest slot is the one whose successor doesn't follow on
+// from it.  Finding it only reads the sequence bytes, and each cell is
+// written once every SEED_SLOTS boots instead of every boot.
+//
+// A write interrupted by a reset leaves at worst a slot whose sequence
+// byte doesn't follow on, which just means the previous slot is still
+// the newest.  That needs two slots or more: with one, a reset during
+// seed_commit can leave a half-written seed.
+//
+//  seed_load()     find the newest seed and return the next one (never 0)
+//  seed_commit()   store that seed for the next boot; call it once the
+//                  output is running, since it takes a few ms per byte
+//
+// SEED_SLOTS defaults to as many slots as fit in the EEPROM, up to 255
+// (slots are numbered with a byte).  Sequence numbers wrap at 256, so
+// any ring shorter than that works: a stale slot follows on from the
+// one before it only if the ring is a multiple of 256 slots long.
+
+#ifndef SEED_H
+#define SEED_H
+
+#include <avr/eeprom.h>
+#include <avr/io.h>
+
+#include <stdint.h>
+
+#ifndef SEED_SLOTS
+#define SEED_SLOTS ((E2END + 1) / 5 < 255 ? (E2END + 1) / 5 : 255)
+#endif
+
+#if SEED_SLOTS < 1 || SEED_SLOTS > 255
+#error "SEED_SLOTS must be 1..255"
+#endif
+
+struct seed_slot {
+    uint32_t seed;
+    uint8_t  seq;
+};
+
+static struct seed_slot EEMEM seed_slots[SEED_SLOTS] = {{1, 0}};
+
+static uint8_t  seed_next_slot;
+static uint8_t  seed_next_seq;
+static uint32_t seed_next;
+
+static uint32_t seed_load() {
+    uint8_t i = 0, seq = eeprom_read_byte(&seed_slots[0].seq);
+
+    while (i < SEED_SLOTS - 1) {
+        uint8_t next = eeprom_read_byte(&seed_slots[i + 1].seq);
+        if (next != (uint8_t) (seq + 1)) break;
+        seq = next;
+        i++;
+    }
+
+    seed_next_slot  = i < SEED_SLOTS - 1 ? i + 1 : 0;
+    seed_next_seq   = seq + 1;
+
+    // increment at least once, skip 0 if we hit it
+    // (0 is the only truly unacceptable seed)
+    seed_next = eeprom_read_dword(&seed_slots[i].seed);
+    do {seed_next++;} while (!seed_next);
+
+    return seed_next;
+}
+
+static void seed_commit() {
+    // seed first: the slot only counts once its sequence byte is written
+    eeprom_update_dword(&seed_slots[seed_next_slot].seed, seed_next);
+    eeprom_update_byte(&seed_slots[seed_next_slot].seq, seed_next_seq);
+}
+
+#endif
@@ -0,0 +1,110 @@
+#!/usr/bin/env runhaskell
+module Main where
+
+import Control.Monad
+import Data.AVR.VCD
+import Data.Char
+import Development.Shake
+import Development.Shake.AVR
+import Development.Shake.FilePath
+import Text.Printf
+
+-- host tests of the shared headers (test/*.c), against stand-ins for
+-- avr-libc (test/stub)
+testDir         = "test"
+buildDir        = "build"
+hostCFlags      = ["-std=gnu99", "-Wall", "-O2", "-I" ++ testDir </> "stub", "-I."]
+
+-- the LFSR32 engines, which all have to give the same sequence
+prngEngines     = ["PRNG_LFSR32", "PRNG_LFSR32_NIBBLE", "PRNG_LFSR32_BYTE"]
+normalSamplers  = ["NORMAL_BINOMIAL", "NORMAL_POPCOUNT", "NORMAL_INVCDF"]
+-- seed.h ring sizes: the attiny13's 12, and powers of two, which it
+-- once refused
+seedSlots       = [2, 12, 128, 255]
+
+hostTests =
+    [ ("prng_test_" ++ lowerName e, "prng_test.c", ["-DPRNG_ENGINE=" ++ e])
+    | e <- prngEngines
+    ] ++
+    [ ("normal_test", "normal_test.c", [])
+    , ("fade_test",   "fade_test.c",   [])
+    ] ++
+    [ ("seed_test_" ++ show n, "seed_test.c", ["-DSEED_SLOTS=" ++ show n])
+    | n <- seedSlots
+    ]
+
+-- "bench" runs test/bench.c under simavr, once per PRNG engine and
+-- once per normal() sampler (on the attiny13 flicker examples' engine),
+-- and counts cycles between its writes to GPIOR0 (which the attiny13
+-- itself doesn't have)
+benchDevice     = "attiny85"
+benchClock      = 8000000
+benchDraws      = 1000
+benchGPIOR0     = 0x31
+
+benchRuns =
+    [ (e, ["-DPRNG_ENGINE=" ++ e], ["rand(1)", "rand(4)", "rand(8)"])
+    | e <- prngEngines ++ ["PRNG_XORSHIFT32", "PRNG_LFSR16"]
+    ] ++
+    [ (s, ["-DPRNG_ENGINE=PRNG_LFSR32", "-DBENCH_NORMAL", "-DNORMAL_SAMPLER=" ++ s], ["normal()"])
+    | s <- normalSamplers
+    ]
+
+benchFlags = ["-Wall", "-Os", "-I.",
+    "-DF_CPU=" ++ show benchClock ++ "UL",
+    "-DBENCH_DRAWS=" ++ show benchDraws,
+    "-mmcu=" ++ benchDevice]
+
+-- "PRNG_LFSR32_BYTE" -> "lfsr32_byte"
+lowerName = map toLower . drop 1 . dropWhile (/= '_')
+
+main = shakeArgs shakeOptions $ do
+    want ["test"]
+    
+    "clean" ~> removeFilesAfter "." [buildDir, "bench.txt"]
+    
+    "test"  ~> do
+        let tests = [buildDir </> name | (name, _, _) <- hostTests]
+        need tests
+        mapM_ (\test -> command_ [] test []) tests
+    
+    forM_ hostTests $ \(name, src, flags) ->
+        buildDir </> name *> \out -> do
+            headers <- getDirectoryFiles "" ["*.h", testDir ++ "//*.h"]
+            need ((testDir </> src) : headers)
+            command_ [] "cc" (hostCFlags ++ flags ++ [testDir </> src, "-o", out, "-lm"])
+    
+    "bench" ~> need ["bench.txt"]
+    "bench.txt" *> \out -> do
+        let runs = [(name, buildDir </> "bench_" ++ lowerName name, columns) | (name, _, columns) <- benchRuns]
+        need [run <.> ext | (_, run, _) <- runs, ext <- ["elf", "vcd"]]
+        rows <- forM runs $ \(name, run, columns) -> do
+            Stdout size <- command [] "avr-size" [run <.> "elf"]
+            cycles <- benchCycles (length columns) (run <.> "vcd")
+            return $ printf "%-20s %6s  " name (head (words (lines size !! 1)))
+                ++ unwords [printf "%s %.1f" c n | (c, n) <- zip columns cycles]
+        let report = unlines (printf "%-20s %6s  cycles per call (%s)" "" "text" benchDevice : rows)
+        writeFileChanged out report
+        putNormal report
+    
+    forM_ benchRuns $ \(name, flags, _) -> do
+        let run = buildDir </> "bench_" ++ lowerName name
+        
+        run <.> "vcd" *> \out ->
+            simavr benchDevice benchClock ["--start-vcd"]
+                [RegisterTrace "GPIOR0" benchGPIOR0 0xff] 2 (run <.> "elf") out
+        run <.> "elf" *> \out -> avr_ld' "avr-gcc" (benchFlags ++ flags) [run <.> "o"] out
+        run <.> "o"   *> \out -> avr_gcc (benchFlags ++ flags) (testDir </> "bench.c") out
+
+-- cycles per call between consecutive marker writes
+benchCycles :: Int -> FilePath -> Action [Double]
+benchCycles n vcd = do
+    signals <- liftIO (readVCD vcd)
+    marks <- case findSignal "GPIOR0" signals of
+        Just s  -> return [t | (t, v) <- signalChanges s, v /= 0]
+        Nothing -> fail (vcd ++ ": no GPIOR0 trace")
+    when (length marks /= n + 1) $
+        fail (vcd ++ ": the benchmark didn't finish; give simavr longer")
+    return [ (b - a) * fromIntegral benchClock / fromIntegral benchDraws
+           | (a, b) <- zip marks (tail marks)
+           ]
@@ -0,0 +1,43 @@
+// AVR benchmark for prng.h, built once per engine (-DPRNG_ENGINE=...),
+// and normal.h, once per sampler (-DBENCH_NORMAL -DNORMAL_SAMPLER=...),
+// and run under simavr by "shake bench".  GPIOR0 is written before and
+// after BENCH_DRAWS calls of each kind, so the time between writes in
+// the trace, in cycles, over BENCH_DRAWS is the cost of one call (plus
+// a few cycles of loop).
+
+#include <avr/io.h>
+
+#include <stdint.h>
+
+#include "prng.h"
+#ifdef BENCH_NORMAL
+#include "normal.h"
+#endif
+
+#ifndef BENCH_DRAWS
+#define BENCH_DRAWS 1000
+#endif
+
+static volatile uint8_t sink;
+
+int main() {
+    uint16_t i;
+    
+    prng_seed(1);
+    
+#ifdef BENCH_NORMAL
+    GPIOR0 = 1;
+    for (i = 0; i < BENCH_DRAWS; i++) sink = normal();
+    GPIOR0 = 2;
+#else
+    GPIOR0 = 1;
+    for (i = 0; i < BENCH_DRAWS; i++) sink = rand(1);
+    GPIOR0 = 2;
+    for (i = 0; i < BENCH_DRAWS; i++) sink = rand(4);
+    GPIOR0 = 3;
+    for (i = 0; i < BENCH_DRAWS; i++) sink = rand(8);
+    GPIOR0 = 4;
+#endif
+    
+    for (;;);
+}
@@ -0,0 +1,81 @@
+// Host check of fade.h, run by "shake test":
+//
+//  - every ramp (each start and target level, 1..255 ticks) stays within
+//    one 8.8 unit of the straight line between them, moves the right
+//    way every tick, and ends exactly on the target;
+//  - fade_gamma never decreases and covers the whole table, from
+//    gamma_table[0] at level 0 to gamma_table[32] at 255 << 8.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// filled in by main, as avr_gamma_header would (2.2, 16 bits)
+#define GAMMA_BITS 16
+static uint16_t gamma_table[33];
+
+#include "fade.h"
+
+static int failures;
+
+static void check_ramp(uint8_t from, uint8_t to, uint8_t ticks) {
+    struct fade f = { 0 };
+    int32_t start = (int32_t) from << 8, goal = (int32_t) to << 8;
+    int32_t last = start;
+
+    fade_to(&f, from, 1);
+    fade_tick(&f);
+    fade_to(&f, to, ticks);
+
+    for (uint16_t t = 1; t <= ticks; t++) {
+        fade_tick(&f);
+
+        double exact = start + (double) (goal - start) * t / ticks;
+        int32_t level = f.level;
+
+        if (fabs(level - exact) > 1 || (goal > start ? level < last : level > last)) {
+            printf("ramp %u -> %u over %u ticks: tick %u at %ld, expected %.1f\n",
+                from, to, ticks, t, (long) level, exact);
+            failures++;
+            return;
+        }
+        last = level;
+    }
+
+    if (f.level != goal) {
+        printf("ramp %u -> %u over %u ticks: ended at %u\n", from, to, ticks, f.level);
+        failures++;
+    }
+}
+
+int main(void) {
+    for (uint8_t i = 0; i <= 32; i++) gamma_table[i] = round(65535 * pow(i / 32.0, 2.2));
+
+    for (uint16_t from = 0; from < 256; from += 15) {
+        for (uint16_t to = 0; to < 256; to++) {
+            for (uint16_t ticks = 1; ticks < 256; ticks++) check_ramp(from, to, ticks);
+        }
+    }
+
+    uint16_t last = 0;
+    for (uint32_t level = 0; level <= 0xFF00; level++) {
+        uint16_t x = fade_gamma(level);
+        if (x < last) {
+            printf("fade_gamma(%04lx) = %u, less than the level before\n", (unsigned long) level, x);
+            failures++;
+            break;
+        }
+        last = x;
+    }
+    if (fade_gamma(0) != gamma_table[0] || fade_gamma(0xFF00) != gamma_table[32]) {
+        printf("fade_gamma doesn't span the table: %u..%u, not %u..%u\n",
+            fade_gamma(0), fade_gamma(0xFF00), gamma_table[0], gamma_table[32]);
+        failures++;
+    }
+
+    if (failures) return 1;
+
+    printf("fade: all checks passed\n");
+    return 0;
+}
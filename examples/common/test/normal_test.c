@@ -0,0 +1,129 @@
+// Host check of normal.h, run by "shake test".  Every sampler is fed
+// every possible input (its random bits counted up from 0, in place of
+// prng.h), so the distributions below are exact:
+//
+//  - NORMAL_POPCOUNT has to give the same sample as NORMAL_BINOMIAL for
+//    every input;
+//  - each sampler's distribution is compared bin by bin with N(0, 32)
+//    rounded to integers (wrapped into -128..127, as the binomial
+//    samplers' results are), and has to stay within the figures
+//    normal.h documents.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PRNG_H
+static uint32_t input;
+static uint8_t input_bits;
+
+// the next 'bits' bits of 'input', highest first
+static uint8_t rand(uint8_t bits) {
+    input_bits -= bits;
+    return (input >> input_bits) & ((1u << bits) - 1);
+}
+
+#define NORMAL_SAMPLER NORMAL_BINOMIAL
+#define normal sample_binomial
+#include "normal.h"
+#undef normal
+#undef NORMAL_SAMPLER
+#undef NORMAL_H
+
+#define NORMAL_SAMPLER NORMAL_POPCOUNT
+#define normal sample_popcount
+#include "normal.h"
+#undef normal
+#undef NORMAL_SAMPLER
+#undef NORMAL_H
+
+#define NORMAL_SAMPLER NORMAL_INVCDF
+#define normal sample_invcdf
+#include "normal.h"
+#undef normal
+
+static int failures;
+
+static int8_t draw(int8_t (*sampler)(), uint8_t bits, uint32_t i) {
+    input = i;
+    input_bits = bits;
+
+    int8_t x = sampler();
+
+    if (input_bits) {
+        printf("sampler left %u of its %u bits unused\n", input_bits, bits);
+        failures++;
+    }
+
+    return x;
+}
+
+static double phi(double x) {
+    return 0.5 * erfc(-x / sqrt(2));
+}
+
+// 'max_total' and 'max_bin' are the misallocated probability and the
+// largest error in any one bin, as fractions
+static void check(const char *name, int8_t (*sampler)(), uint8_t bits,
+                  double max_total, double max_bin) {
+    static uint32_t counts[256];
+    double want[256] = { 0 };
+    double mean = 0, var = 0, total = 0, worst = 0;
+    int worst_at = 0;
+    uint32_t n = 1ul << bits;
+
+    for (int i = 0; i < 256; i++) counts[i] = 0;
+    for (uint32_t i = 0; i < n; i++) counts[(uint8_t) draw(sampler, bits, i)]++;
+
+    // N(0, 32) rounded, folded into -128..127 (its tails beyond about
+    // 4 sd add nothing measurable)
+    for (int k = -512; k < 512; k++) {
+        want[(uint8_t) k] += phi((k + 0.5) / 32) - phi((k - 0.5) / 32);
+    }
+
+    for (int k = -128; k < 128; k++) {
+        double p = counts[(uint8_t) k] / (double) n;
+        double err = p - want[(uint8_t) k];
+
+        mean    += p * k;
+        var     += p * k * k;
+        total   += fabs(err);
+        if (fabs(err) > fabs(worst)) {
+            worst = err;
+            worst_at = k;
+        }
+    }
+    var -= mean * mean;
+
+    printf("%-16s %2u bits: mean %+.3f, sd %.3f; %.2f%% misallocated, worst bin %+d off by %+.4f%%\n",
+        name, bits, mean, sqrt(var), total * 100, worst_at, worst * 100);
+
+    if (total > max_total || fabs(worst) > max_bin) {
+        printf("%s: worse than documented (%.2f%%, %.3f%%)\n", name, max_total * 100, max_bin * 100);
+        failures++;
+    }
+    if (fabs(sqrt(var) - 32) > 1) {
+        printf("%s: sd isn't close to 32\n", name);
+        failures++;
+    }
+}
+
+int main(void) {
+    for (uint32_t i = 0; i < 1ul << 24; i++) {
+        if (draw(sample_binomial, 24, i) != draw(sample_popcount, 24, i)) {
+            printf("NORMAL_POPCOUNT: input %06lx gives %d, NORMAL_BINOMIAL %d\n",
+                (unsigned long) i, draw(sample_popcount, 24, i), draw(sample_binomial, 24, i));
+            failures++;
+            break;
+        }
+    }
+
+    check("NORMAL_BINOMIAL", sample_binomial, 24, 0.0312, 0.0005);
+    check("NORMAL_POPCOUNT", sample_popcount, 24, 0.0312, 0.0005);
+    check("NORMAL_INVCDF",   sample_invcdf,   15, 0.0284, 0.00045);
+
+    if (failures) return 1;
+
+    printf("normal: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,98 @@
+// Host check of prng.h, run by "shake test" once for each LFSR32
+// engine (-DPRNG_ENGINE=...): a long run of draws of mixed widths has to
+// match a reference bit-at-a-time LFSR bit for bit, and leave the same
+// state.  Afterwards it prints how long each width takes on the host,
+// which only says how the engines compare there; "shake bench" counts
+// AVR cycles under simavr.
+//
+// Don't include stdlib.h here: prng.h has its own rand().
+
+#include "prng.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#if PRNG_ENGINE == PRNG_LFSR32
+#define ENGINE "PRNG_LFSR32"
+#elif PRNG_ENGINE == PRNG_LFSR32_NIBBLE
+#define ENGINE "PRNG_LFSR32_NIBBLE"
+#elif PRNG_ENGINE == PRNG_LFSR32_BYTE
+#define ENGINE "PRNG_LFSR32_BYTE"
+#else
+#error "only the LFSR32 engines share a reference sequence"
+#endif
+
+#define DRAWS   1000000ul
+
+static uint32_t ref = 1;
+
+static uint8_t ref_rand(uint8_t bits) {
+    uint8_t x = 0;
+    
+    while (bits--) {
+        ref = (ref >> 1) ^ (-(ref & 1ul) & 0xA3AC183Cul);
+        x = x << 1 | (ref & 1);
+    }
+    
+    return x;
+}
+
+// widths to draw, independent of the generators under test
+static uint32_t widths = 2463534242ul;
+
+static uint8_t next_width(void) {
+    widths ^= widths << 13;
+    widths ^= widths >> 17;
+    widths ^= widths << 5;
+    return 1 + widths % 8;
+}
+
+static int check(uint32_t seed) {
+    prng_seed(seed);
+    ref = seed ? seed : 1;
+    
+    for (uint32_t n = 0; n < DRAWS; n++) {
+        uint8_t bits = next_width();
+        uint8_t got = rand(bits), want = ref_rand(bits);
+        
+        if (got != want) {
+            printf("%s: seed %08lx, draw %lu of %u bits: got %02x, expected %02x\n", ENGINE,
+                (unsigned long) seed, (unsigned long) n, bits, got, want);
+            return 1;
+        }
+    }
+    
+    if (lfsr != ref) {
+        printf("%s: seed %08lx: final state %08lx, expected %08lx\n", ENGINE,
+            (unsigned long) seed, (unsigned long) lfsr, (unsigned long) ref);
+        return 1;
+    }
+    
+    return 0;
+}
+
+static volatile uint8_t sink;
+
+static double ns_per_draw(uint8_t bits) {
+    clock_t start = clock();
+    
+    for (uint32_t n = 0; n < 10 * DRAWS; n++) sink = rand(bits);
+    
+    return (clock() - start) * 1e9 / CLOCKS_PER_SEC / (10 * DRAWS);
+}
+
+int main(void) {
+    static const uint32_t seeds[] = { 0, 1, 0xDEADBEEFul, 0x80000000ul, 0xFFFFFFFFul };
+    int failures = 0;
+    
+    for (uint8_t i = 0; i < sizeof seeds / sizeof *seeds; i++) failures += check(seeds[i]);
+    
+    if (failures) return 1;
+    
+    printf("%s: %lu mixed draws from each of %u seeds match the reference\n", ENGINE,
+        DRAWS, (unsigned) (sizeof seeds / sizeof *seeds));
+    printf("%s: host ns per draw: rand(1) %.1f, rand(4) %.1f, rand(8) %.1f\n", ENGINE,
+        ns_per_draw(1), ns_per_draw(4), ns_per_draw(8));
+    
+    return 0;
+}
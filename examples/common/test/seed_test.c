@@ -0,0 +1,172 @@
+// Host check of seed.h, run by "shake test" once for each of a few ring
+// sizes (-DSEED_SLOTS=...), with the EEPROM stubbed out:
+//
+//  - BOOTS boots in a row each get the seed after the one before;
+//  - no byte is written more than once every SEED_SLOTS boots, and the
+//    bytes written per boot (eeprom_update_* skipping unchanged ones)
+//    are reported;
+//  - a reset after each possible number of byte writes in seed_commit,
+//    around each point where the ring wraps (over enough boots for the
+//    sequence numbers to roll over too), with the byte being
+//    written left either erased or untouched, costs at most one
+//    repeated seed, and the boots after it carry on in sequence;
+//  - so does starting from an erased EEPROM.
+//
+// "shake boot" in the flicker examples checks the same on the device,
+// under simavr.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "seed.h"
+
+#define BOOTS   1000
+
+static uint8_t * const eeprom = (uint8_t *) seed_slots;
+static uint8_t  initial[sizeof seed_slots];
+static uint32_t cell_writes[sizeof seed_slots];
+static uint32_t writes;
+
+// byte writes that complete before the reset, or -1 for none; the one
+// after that leaves its byte erased if 'torn_erased' is set
+static int      power_left = -1;
+static bool     torn_erased;
+static bool     reset;
+
+static int failures;
+
+uint8_t eeprom_read_byte(const uint8_t *p) {
+    return *p;
+}
+
+uint32_t eeprom_read_dword(const uint32_t *p) {
+    const uint8_t *b = (const uint8_t *) p;
+    return b[0] | (uint32_t) b[1] << 8 | (uint32_t) b[2] << 16 | (uint32_t) b[3] << 24;
+}
+
+void eeprom_update_byte(uint8_t *p, uint8_t value) {
+    if (reset || *p == value) return;
+
+    if (power_left == 0) {
+        if (torn_erased) *p = 0xFF;
+        reset = true;
+        return;
+    }
+    if (power_left > 0) power_left--;
+
+    *p = value;
+    writes++;
+    cell_writes[p - eeprom]++;
+}
+
+void eeprom_update_dword(uint32_t *p, uint32_t value) {
+    uint8_t *b = (uint8_t *) p;
+
+    for (uint8_t i = 0; i < 4; i++) eeprom_update_byte(b + i, value >> (8 * i));
+}
+
+static void power_on(const uint8_t *contents) {
+    memcpy(eeprom, contents, sizeof seed_slots);
+    memset(cell_writes, 0, sizeof cell_writes);
+    writes = 0;
+}
+
+static uint32_t boot(void) {
+    uint32_t seed = seed_load();
+
+    if (seed == 0) {
+        printf("SEED_SLOTS=%u: seed_load returned 0\n", SEED_SLOTS);
+        failures++;
+    }
+    seed_commit();
+    reset = false;
+    power_left = -1;
+
+    return seed;
+}
+
+// 'count' boots have to carry on in sequence from 'seed'
+static void check_sequence(const char *what, uint32_t seed, uint16_t count) {
+    for (uint16_t n = 0; n < count; n++) {
+        uint32_t next = boot();
+        if (next != ++seed) {
+            printf("SEED_SLOTS=%u: %s: boot %u got seed %lu, not %lu\n",
+                SEED_SLOTS, what, n, (unsigned long) next, (unsigned long) seed);
+            failures++;
+            return;
+        }
+    }
+}
+
+static void check_wear(void) {
+    uint32_t most = 0;
+
+    power_on(initial);
+    check_sequence("in a row", 1, BOOTS);
+
+    for (size_t i = 0; i < sizeof seed_slots; i++) {
+        if (cell_writes[i] > most) most = cell_writes[i];
+    }
+    if (most > (BOOTS + SEED_SLOTS - 1) / SEED_SLOTS) {
+        printf("SEED_SLOTS=%u: a byte was written %lu times in %u boots\n",
+            SEED_SLOTS, (unsigned long) most, BOOTS);
+        failures++;
+    }
+
+    printf("SEED_SLOTS=%u: %.2f bytes written per boot, at most %lu times each in %u boots\n",
+        SEED_SLOTS, writes / (double) BOOTS, (unsigned long) most, BOOTS);
+}
+
+// reset during the commit of boot number 'before' + 1, after 'done'
+// byte writes
+static void check_reset(uint16_t before, uint8_t done, bool erased) {
+    uint32_t seed;
+    char what[64];
+
+    power_on(initial);
+    for (uint16_t n = 0; n < before; n++) boot();
+
+    power_left  = done;
+    torn_erased = erased;
+    seed = boot();
+
+    // the interrupted boot's seed may come round once more
+    seed_load();
+    if (seed_next == seed) seed--;
+
+    snprintf(what, sizeof what, "reset after %u writes (%s) on boot %u",
+        done, erased ? "erased" : "untouched", before + 1);
+    check_sequence(what, seed, 2 * SEED_SLOTS + 2);
+}
+
+int main(void) {
+    memcpy(initial, eeprom, sizeof seed_slots);
+
+    check_wear();
+
+    // around the start and each wrap of the ring, until the sequence
+    // numbers have rolled over twice
+    static const int16_t around[] = { -2, -1, 0, 1, 2 };
+    for (uint16_t lap = 0; lap * SEED_SLOTS <= 2 * 255 + SEED_SLOTS; lap++) {
+        for (uint8_t i = 0; i < sizeof around / sizeof *around; i++) {
+            int16_t before = lap * SEED_SLOTS + around[i];
+            if (before < 0) continue;
+
+            for (uint8_t done = 0; done <= 5; done++) {
+                check_reset(before, done, true);
+                check_reset(before, done, false);
+            }
+        }
+    }
+
+    uint8_t erased[sizeof seed_slots];
+    memset(erased, 0xFF, sizeof erased);
+    power_on(erased);
+    check_sequence("erased EEPROM", boot(), 2 * SEED_SLOTS + 2);
+
+    if (failures) return 1;
+
+    printf("seed: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef ___n_stub_avr_eeprom_h__
+#define ___n_stub_avr_eeprom_h__
+
+#include <stdint.h>
+
+// the EEPROM is ordinary memory; the test that includes this defines
+// the accessors, so it can count and interrupt writes
+#define EEMEM
+
+uint8_t     eeprom_read_byte(const uint8_t *p);
+uint32_t    eeprom_read_dword(const uint32_t *p);
+void        eeprom_update_byte(uint8_t *p, uint8_t value);
+void        eeprom_update_dword(uint32_t *p, uint32_t value);
+
+#endif /* ___n_stub_avr_eeprom_h__ */
@@ -0,0 +1,11 @@
+#ifndef ___n_stub_avr_pgmspace_h__
+#define ___n_stub_avr_pgmspace_h__
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(p)    (*(const uint8_t *) (p))
+#define pgm_read_word(p)    (*(const uint16_t *) (p))
+#define pgm_read_dword(p)   (*(const uint32_t *) (p))
+
+#endif /* ___n_stub_avr_pgmspace_h__ */
@@ -10,24 +10,83 @@ clock   = round 9.6e6
 
 avrdudeFlags    = ["-c", "dragon_isp"]
 
+-- candle filter: 2nd-order low-pass, cutoff (Hz) and update rate (Hz,
+-- must divide the 2343.75 Hz PWM rate)
+cutoff      = 2.2
+updateRate  = 156.25
+
+-- the filter's output std dev, in intensity steps: flicker.c centers
+-- the output on 171 and puts 2 std devs at full brightness
+swing       = (255 - 171) / 2
+
 cFlags = ["-Wall", "-Os",
+    "-I../common",
     "-DF_CPU=" ++ show clock ++ "UL",
     "-mmcu=" ++ device]
 
+-- for "sleep"
+traceFlags = cFlags ++ ["-DFRAME_TRACE"]
+
 main = shakeArgs shakeOptions $ do
     want ["flicker.hex"]
     
-    "clean" ~> removeFilesAfter "." ["*.o", "*.elf", "*.hex"]
-    "flash" ~> avrdude device avrdudeFlags (w Flash "flicker.hex")
+    "clean"  ~> removeFilesAfter "." ["*.o", "*.elf", "*.hex", "*.eep", "gamma.h", "filter.h", "filter.txt", "*.vcd", "*.report", "trace"]
+    "flash"  ~> avrdude device avrdudeFlags (w Flash "flicker.hex")
+    "eeprom" ~> avrdude device avrdudeFlags (w EEPROM "flicker.eep")
+    
+    -- run after "flash": finds the fastest bit clock that still verifies,
+    -- which "flash-fast" then uses
+    "calibrate"  ~> avrdude_calibrate device avrdudeFlags "flicker.hex"
+    "flash-fast" ~> avrdude_calibrated device avrdudeFlags (w Flash "flicker.hex")
+    
+    -- simulated PWM output: update rate, jitter, duty cycles and spectrum,
+    -- checked against the filter's cutoff
+    "pwm" ~> need ["flicker.report"]
+    "flicker.report" *> \out -> pwm_report "flicker.vcd" [("OCR0A", "PB0")] (Just cutoff) out
+    "flicker.vcd" *> \out -> simavr device clock ["--start-vcd"]
+        [ RegisterTrace "OCR0A" 0x56 0xff
+        , PinTrace      "PB0"   0x38 0x01
+        ] 30 "flicker.elf" out
+    
+    -- simulated boot from the seed in flicker.eep: how long until the
+    -- LED is first driven, and the EEPROM writes seed.h makes on the way
+    "boot" ~> need ["boot.report"]
+    "boot.report" *> boot_report "boot.vcd" "OCR0A" "EECR"
+    "boot.vcd" *> \out -> simavr device clock ["--start-vcd"]
+        [ RegisterTrace "OCR0A" 0x56 0xff
+        , RegisterTrace "EECR"  0x3c 0x02   -- EEPE
+        ] 2 "flicker.elf" out
+    
+    -- simulated sleep behaviour of a FRAME_TRACE build (see
+    -- ../common/frames.h): wakeups and active CPU cycles, per second and
+    -- per frame
+    "sleep" ~> need ["sleep.report"]
+    "sleep.report" *> sleep_report "sleep.vcd" "awake" "frame" clock
+    "sleep.vcd" *> \out -> simavr device clock ["--start-vcd"]
+        [ PinTrace "awake" 0x38 0x10    -- PB4
+        , PinTrace "frame" 0x38 0x08    -- PB3
+        ] 10 ("trace" </> "flicker.elf") out
+    
+    "trace/flicker.elf" *> \out -> do
+        srcs <- getDirectoryFiles "." ["*.c"]
+        let objs = ["trace" </> src `replaceExtension` "o" | src <- srcs]
+        avr_ld' "avr-gcc" traceFlags objs out
+    "trace/*.o" *> \out -> do
+        let src = takeFileName out `replaceExtension` "c"
+        avr_gcc traceFlags src out
     
     "flicker.elf" *> \out -> do
         srcs <- getDirectoryFiles "." ["*.c"]
         let objs = [src `replaceExtension` "o" | src <- srcs]
         avr_ld' "avr-gcc" cFlags objs out
     
-    "*.hex" *> \out -> do
-        let elf = out `replaceExtension` "elf"
-        avr_objcopy "ihex" ["-j", ".text", "-j", ".data"] elf out
+    ["flicker.hex", "flicker.eep"] &*> \[hex, eep] -> do
+        avr_extract "flicker.elf" [(Flash, hex), (EEPROM, eep)]
+    
+    "gamma.h" *> avr_gamma_header 2.2 16
+    ["filter.h", "filter.txt"] &*> \[h, txt] ->
+        avr_filter (lowpass "flicker_filter" 2 cutoff updateRate)
+            { filterOutputSigma = Just swing } h txt
     
     "*.o" *> \out -> do
         let src = out `replaceExtension` "c"
@@ -19,13 +19,23 @@ buildRoot       = "build"
 localBuildDir   = buildRoot </> "local"
 asfBuildDir     = buildRoot </> "asf"
 
+-- all of asfIncludes, consolidated into one include directory
+includeManifest = buildRoot </> "include" </> "MANIFEST"
+
 elfFile         = "hid.elf"
+binFile         = "hid.bin"
 mapFile         = "hid.map"
 
+-- openocd board config, and the flash erase granularity as openocd's
+-- at91samd driver reports it (16 lock regions over 16KB)
+openocdCfgs     = ["atmel_samd11_xplained_pro.cfg"]
+flashSector     = 1024
+flashBase       = 0
+
 commonFlags     = ["-pipe"] ++ optFlags
 optFlags        = ["-O1", "-ffunction-sections", "-fdata-sections", "-fno-strict-aliasing"]
 
-cppFlags        = asfDefines ++ map (("-I" ++) . (asfDir </>)) asfIncludes
+cppFlags        = asfDefines ++ ["-I" ++ takeDirectory includeManifest]
 
 cFlags = commonFlags ++ cppFlags ++ ["-Wall", "-Werror", "-std=gnu99"]
     ++ ["-mcpu=cortex-m0plus", "-mthumb"]
@@ -122,6 +132,7 @@ compileRules fromDir toDir =
                 ["Build rule matched", show out,
                 "which does not start with", show toDir]
         
+        avr_need_include_tree includeManifest
         case takeExtension src of
             ".c" -> avr_gcc' "arm-none-eabi-gcc" cFlags src out
             ".s" -> avr_gcc' "arm-none-eabi-gcc" asFlags src out
@@ -131,8 +142,10 @@ main = shakeArgs shakeOptions $ do
     want ["size"]
     
     "size"      ~> avr_size' "arm-none-eabi-size" elfFile
-    "clean"     ~> removeFilesAfter "." [elfFile, mapFile, buildRoot]
-    "flash"     ~> command_ [] "openocd" ["-f", "flash.cfg"]
+    "clean"     ~> removeFilesAfter "." [elfFile, binFile, mapFile, buildRoot]
+    "flash"     ~> openocd_flash openocdCfgs
+        (flashProbe 0 >> raw "at91samd eeprom 0")
+        flashSector flashBase binFile
     
     -- asfDir *> \out -> do
     --     exists <- doesDirectoryExist out
@@ -144,5 +157,12 @@ main = shakeArgs shakeOptions $ do
             cmsisLib  = ["asf/thirdparty/CMSIS/Lib/GCC/libarm_cortexM0l_math.a"]
         avr_ld' "arm-none-eabi-gcc" ldFlags (asfObjs ++ cmsisLib) elfFile
     
+    binFile *> \out -> do
+        avr_objcopy' "arm-none-eabi-objcopy" "binary" [] elfFile out
+    
+    includeManifest *> \out -> do
+        avr_include_tree (map (asfDir </>) asfIncludes) out
+    takeDirectory includeManifest ++ "//*.h" *> avr_include_header includeManifest
+    
     compileRules asfDir asfBuildDir
     compileRules srcDir localBuildDir
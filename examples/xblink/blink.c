@@ -1,9 +1,32 @@
 #define HAVE_XTAL       0
 #define BLINK_DELAY_MS  500
 
+#include <avr/interrupt.h>
 #include <avr/io.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 
+#include "gamma.h"
+
+#include "fade.h"
+
+// fades are stepped at the PWM rate: F_CPU / (2 * PER) = 244 Hz (the
+// timer runs in DSBOTTOM mode, so the overflow comes once a period)
+#define PWM_RATE        (F_CPU / (2 * 0xFFFFul))
+#define FADE_TICKS      ((uint8_t) (PWM_RATE * BLINK_DELAY_MS / 1000)) // < 256
+
+static struct fade led;
+ISR(TCC0_OVF_vect) {
+    uint16_t x = fade_tick(&led);
+    TCC0.CCABUF = TCC0.CCBBUF = TCC0.CCCBUF = x;
+}
+
+static void blink_to(uint8_t level) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        fade_to(&led, level, FADE_TICKS);
+    }
+}
+
 int main(void)
 {
     PORTC.DIRSET = 0b00000111;
@@ -47,7 +70,7 @@ int main(void)
     // Set up 3-channel 16-bit dual-slope pwm on PORTC 0-2
     TCC0.PER = 0xFFFF;
     
-    TCC0.CTRLB = TC_WGMODE_DSBOTH_gc | TC0_CCAEN_bm | TC0_CCBEN_bm | TC0_CCCEN_bm;
+    TCC0.CTRLB = TC_WGMODE_DSBOTTOM_gc | TC0_CCAEN_bm | TC0_CCBEN_bm | TC0_CCCEN_bm;
     TCC0.CTRLC = 0;
     TCC0.CTRLD = 0;
     TCC0.CTRLE = 0;
@@ -56,14 +79,20 @@ int main(void)
     TCC0.CCB = 0;
     TCC0.CCC = 0;
     
-    // start the timer
+    // start the timer, with the fade engine on its overflow
+    TCC0.INTCTRLA = TC_OVFINTLVL_LO_gc;
+    PMIC.CTRL |= PMIC_LOLVLEN_bm;
     TCC0.CTRLA = TC_CLKSEL_DIV1_gc;
+    sei();
     
     PORTC.DIRSET = 0b00000111;
     
+    // gamma-corrected fades between the levels that used to be written
+    // directly: 136 and 72 of 255 come out as duty cycles of about
+    // 0x4000 and 0x1000.
     while(1){
+        blink_to(136);
         _delay_ms( BLINK_DELAY_MS ) ;
-        TCC0.CCABUF = TCC0.CCBBUF = TCC0.CCCBUF = 0x4000;
+        blink_to(72);
         _delay_ms( BLINK_DELAY_MS ) ;
-        TCC0.CCABUF = TCC0.CCBBUF = TCC0.CCCBUF = 0x1000;
     }}
\ No newline at end of file
@@ -11,13 +11,14 @@ clock           = round 32e6
 avrdudeFlags    = ["-c", "flip2"]
 
 cFlags = ["-Wall", "-Os", 
+    "-I../common",
     "-DF_CPU=" ++ show clock ++ "UL",
     "-mmcu=" ++ device]
 
 main = shakeArgs shakeOptions $ do
     want ["blink.elf"]
     
-    "clean" ~> removeFilesAfter "." ["*.o", "*.elf"]
+    "clean" ~> removeFilesAfter "." ["*.o", "*.elf", "gamma.h"]
     "flash" ~> avrdude device avrdudeFlags (w Application "blink.elf")
     
     "blink.elf" *> \out -> do
@@ -25,5 +26,7 @@ main = shakeArgs shakeOptions $ do
         let objs = map (<.> "o") srcs
         avr_ld' "avr-gcc" cFlags objs out
     
+    "gamma.h" *> avr_gamma_header 2.2 16
+    
     "*.o" *> \out -> do
         avr_gcc cFlags (dropExtension out) out
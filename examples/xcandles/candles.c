@@ -0,0 +1,216 @@
+// Many independent candles on one XMEGA: the flicker_v2 algorithm
+// (normally distributed noise through a 2nd-order Butterworth low-pass)
+// run for CANDLES channels of 16-bit dual-slope PWM, gamma-corrected.
+//
+// Hardware/peripheral usage notes:
+// Channels are the timers' compare outputs, in this order (CANDLES, set
+// in shake.hs, takes the first ones):
+//
+//   0- 3   TCC0 CCA-CCD    PC0-PC3
+//   4- 5   TCC1 CCA-CCB    PC4-PC5
+//   6- 9   TCD0 CCA-CCD    PD0-PD3
+//  10-11   TCD1 CCA-CCB    PD4-PD5
+//  12-15   TCE0 CCA-CCD    PE0-PE3
+//
+// All the timers run in lockstep from the same clock and period, and
+// TCC0's overflow (at BOTTOM) writes every channel's CCxBUF in one
+// pass.  The buffers are copied to the compare registers at the next
+// BOTTOM, so all channels change together, and the ISR only ever does
+// CANDLES stores: the filters are run by the main loop, a frame ahead,
+// into a second copy of the duty cycles.  Keeps the RNG seed in EEPROM.
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+
+#include <stdint.h>
+
+#include "gamma.h"
+#include "filter.h"
+
+#define PRNG_ENGINE PRNG_XORSHIFT32
+
+#include "fade.h"
+#include "prng.h"
+#include "seed.h"
+
+#if CANDLES < 1 || CANDLES > 16
+#error "CANDLES must be 1..16"
+#endif
+#if CANDLES > 1 && FILTER_CHANNELS != CANDLES
+#error "filter.h was generated for a different number of candles"
+#endif
+
+// frames are PWM periods: F_CPU / (2 * PER) = 244 Hz.  The timers run
+// in DSBOTTOM mode so the overflow is only flagged at BOTTOM (DSBOTH
+// would flag TOP as well, running the ISR twice a period and losing
+// every other frame to the second CCxBUF write).
+#define PWM_PER         0xFFFF
+
+// ========= per-candle state (structure of arrays) =========
+
+// The filter state is in filter.h; each candle also gets its own
+// xorshift32 generator, seeded from prng.h's.
+static uint32_t candle_rng[CANDLES];
+
+static void init_rand() {
+    uint8_t i, j;
+
+    prng_seed(seed_load());
+    for (i = 0; i < CANDLES; i++) {
+        uint32_t s = 0;
+        for (j = 0; j < 4; j++) s = s << 8 | rand(8);
+        candle_rng[i] = s ? s : 1;
+    }
+}
+
+// Random bits for normal.h (NORMAL_RAND): one step of a candle's
+// generator gives the 24 bits a NORMAL_POPCOUNT sample takes, lowest
+// first.
+static uint32_t candle_bits;
+
+static inline uint8_t candle_rand(uint8_t bits) {
+    uint8_t r = candle_bits & ((1 << bits) - 1);
+    candle_bits >>= bits;
+    return r;
+}
+
+#define NORMAL_SAMPLER  NORMAL_POPCOUNT
+#define NORMAL_RAND     candle_rand
+#include "normal.h"
+
+// normal() (mean 0, std 32) on candle i's generator
+static int8_t candle_normal(uint8_t i) {
+    uint32_t x = candle_rng[i];
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    candle_rng[i] = x;
+
+    candle_bits = x;
+    return normal();
+}
+
+// Intensity 171 +- 2 std devs (as in flicker_v2), with 4 more bits of
+// resolution: the filter output is scaled to 16ths of an intensity
+// step (see shake.hs), which matters here since there are no fades
+// between updates.
+static uint16_t candle_duty(uint8_t i) {
+    const uint8_t m = 171;
+#if CANDLES > 1
+    int16_t y = flicker_filter(i, candle_normal(i));
+#else
+    int16_t y = flicker_filter(candle_normal(i));
+#endif
+    int32_t level = ((int32_t) m << 8) + ((int32_t) y << 4);
+
+    if (level < 0)      level = 0;
+    if (level > 0xFFFF) level = 0xFFFF;
+    return fade_gamma(level) << (16 - GAMMA_BITS);
+}
+
+// ========= PWM output =========
+
+static volatile uint16_t * const candle_ccbuf[16] = {
+    &TCC0.CCABUF, &TCC0.CCBBUF, &TCC0.CCCBUF, &TCC0.CCDBUF,
+    &TCC1.CCABUF, &TCC1.CCBBUF,
+    &TCD0.CCABUF, &TCD0.CCBBUF, &TCD0.CCCBUF, &TCD0.CCDBUF,
+    &TCD1.CCABUF, &TCD1.CCBBUF,
+    &TCE0.CCABUF, &TCE0.CCBBUF, &TCE0.CCCBUF, &TCE0.CCDBUF,
+};
+
+// how many of the 'count' channels starting at candle 'first' are used
+#define USED(first, count) \
+    (CANDLES <= (first) ? 0 : CANDLES - (first) < (count) ? CANDLES - (first) : (count))
+#define PINS(first, count)  ((1 << USED(first, count)) - 1)
+#define CCEN(first, count)  (PINS(first, count) << 4) // TC0_CCAEN_bm = 0x10, etc.
+
+// TC1_t's registers are at the same offsets as TC0_t's; it just has
+// fewer of them.
+#define PWM_SETUP(tc, first, count)                                 \
+    if (USED(first, count)) {                                       \
+        (tc).PER    = PWM_PER;                                      \
+        (tc).CTRLB  = TC_WGMODE_DSBOTTOM_gc | CCEN(first, count);   \
+        (tc).CNT    = 0;                                            \
+    }
+#define PWM_START(tc, first, count)                                 \
+    if (USED(first, count)) (tc).CTRLA = TC_CLKSEL_DIV1_gc
+
+static void init_pwm() {
+    PORTC.DIRSET = PINS(0, 4) | PINS(4, 2) << 4;
+    PORTD.DIRSET = PINS(6, 4) | PINS(10, 2) << 4;
+    PORTE.DIRSET = PINS(12, 4);
+
+    PWM_SETUP(TCC0, 0, 4);
+    PWM_SETUP(TCC1, 4, 2);
+    PWM_SETUP(TCD0, 6, 4);
+    PWM_SETUP(TCD1, 10, 2);
+    PWM_SETUP(TCE0, 12, 4);
+
+    TCC0.INTCTRLA = TC_OVFINTLVL_LO_gc;
+    PMIC.CTRL |= PMIC_LOLVLEN_bm;
+
+    // start them back to back, so they stay within a few clocks of
+    // each other
+    PWM_START(TCC0, 0, 4);
+    PWM_START(TCC1, 4, 2);
+    PWM_START(TCD0, 6, 4);
+    PWM_START(TCD1, 10, 2);
+    PWM_START(TCE0, 12, 4);
+}
+
+// duty cycles: the ISR sends out candle_frames[candle_front], and the
+// main loop fills in the other one
+static uint16_t candle_frames[2][CANDLES];
+static volatile uint8_t candle_front = 0;
+static volatile uint8_t frame_count = 0;
+
+ISR(TCC0_OVF_vect) {
+    const uint16_t *duty = candle_frames[candle_front];
+    uint8_t i;
+
+    for (i = 0; i < CANDLES; i++) *candle_ccbuf[i] = duty[i];
+    frame_count++;
+}
+
+static void init_clock() {
+    CCP = CCP_IOREG_gc;              // disable register security for oscillator update
+    OSC.CTRL = OSC_RC32MEN_bm;       // enable 32MHz oscillator
+    while(!(OSC.STATUS & OSC_RC32MRDY_bm)); // wait for oscillator to be ready
+    CCP = CCP_IOREG_gc;              // disable register security for clock update
+    CLK.CTRL = CLK_SCLKSEL_RC32M_gc; // switch to 32MHz clock
+}
+
+int main(void)
+{
+    uint8_t i;
+
+    init_clock();
+    init_rand();
+    init_pwm();
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sei();
+    seed_commit();
+
+    while(1)
+    {
+        uint8_t seen = frame_count;
+        uint8_t back = !candle_front;
+
+        // compute the next frame, then sleep till the current one has
+        // gone out (if it hasn't already) and swap.
+        for (i = 0; i < CANDLES; i++) candle_frames[back][i] = candle_duty(i);
+
+        cli();
+        while (frame_count == seen) {
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+            cli();
+        }
+        candle_front = back;
+        sei();
+    }
+}
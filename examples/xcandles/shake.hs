@@ -0,0 +1,48 @@
+#!/usr/bin/env runhaskell
+module Main where
+
+import Development.Shake
+import Development.Shake.AVR
+import Development.Shake.FilePath
+
+device          = "atxmega128a4u"
+clock           = round 32e6
+
+avrdudeFlags    = ["-c", "flip2"]
+
+-- number of independent candles (1..16; see candles.c for the pins)
+candles     = 16
+
+-- the same filter as flicker_v2, updated once per PWM period (16-bit
+-- dual-slope), with its output in 16ths of an intensity step: candles.c
+-- centers the output on 171 and puts 2 std devs at full brightness
+cutoff      = 2.2
+updateRate  = fromIntegral clock / (2 * 0xFFFF)
+swing       = 16 * (255 - 171) / 2
+
+cFlags = ["-Wall", "-Os",
+    "-I../common",
+    "-DCANDLES=" ++ show candles,
+    "-DF_CPU=" ++ show clock ++ "UL",
+    "-mmcu=" ++ device]
+
+main = shakeArgs shakeOptions $ do
+    want ["candles.elf"]
+
+    "clean" ~> removeFilesAfter "." ["*.o", "*.elf", "gamma.h", "filter.h", "filter.txt"]
+    "flash" ~> avrdude device avrdudeFlags (w Application "candles.elf")
+
+    "candles.elf" *> \out -> do
+        srcs <- getDirectoryFiles "." ["*.c"]
+        let objs = map (<.> "o") srcs
+        avr_ld' "avr-gcc" cFlags objs out
+
+    "gamma.h" *> avr_gamma_header 2.2 16
+    ["filter.h", "filter.txt"] &*> \[h, txt] ->
+        avr_filter (lowpass "flicker_filter" 2 cutoff updateRate)
+            { filterOutputSigma = Just swing
+            , filterChannels    = candles
+            } h txt
+
+    "*.o" *> \out -> do
+        avr_gcc cFlags (dropExtension out) out
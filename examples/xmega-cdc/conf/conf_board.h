@@ -4,4 +4,18 @@
 void board_suspend(void);
 void board_resume(void);
 
+// RTS/CTS handshake lines for each bridge port, in UDI CDC port order:
+// { PORT, RTS pin, CTS pin }.  Both are active low, and CTS is pulled
+// down, so a port with nothing connected to it is always clear to send.
+// (The TXD pins, PC3/PC7/PD3/PE3, are set up in main(); these are the
+// free pins next to them.  A CTS pin on any other PORT needs its
+// INT0 vector added to handshake.c.)
+#define BOARD_HANDSHAKE_PINS                \
+    {                                       \
+        { &PORTC, PIN0_bm, PIN1_bm },       \
+        { &PORTC, PIN4_bm, PIN5_bm },       \
+        { &PORTD, PIN0_bm, PIN1_bm },       \
+        { &PORTE, PIN0_bm, PIN1_bm },       \
+    }
+
 #endif /* ___n_conf_board_h__ */
@@ -0,0 +1,13 @@
+#ifndef ___n_conf_pch_h__
+#define ___n_conf_pch_h__
+
+// Headers that nearly every translation unit in this build pulls in.
+// The shake script precompiles this once per flag set and has each
+// C source "-include" it, so the ASF and device headers are parsed once.
+
+#include <compiler.h>
+#include <conf_usb.h>
+#include <udc.h>
+#include <avr/io.h>
+
+#endif /* ___n_conf_pch_h__ */
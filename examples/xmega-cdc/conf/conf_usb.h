@@ -18,12 +18,32 @@
 // on parts with less SRAM this is probably necessary
 // #define UDI_CDC_LOW_RATE
 
+// per-port RX ring for the DMA receive path (see src/rx_dma.h); 0 for
+// an interrupt per received byte instead
+#define CDC_RX_DMA_SIZE 128
+
+// per-port buffer for data on its way from the host to the USART
+#define CDC_TX_BUF_SIZE 64
+
+// low-latency mode for the RX DMA path (see src/rx_dma.h): how often
+// ports in that mode are checked, and the mode they start in (an idle
+// limit, in ticks, of 0 is off).  The host can change it per port with
+// a vendor request.
+#define CDC_LATENCY_TICK_US     250
+#define CDC_LATENCY_IDLE        0
+#define CDC_LATENCY_THRESHOLD   32
+
+// the latency tick's interrupt runs at this level too (rx_dma.c)
+#define UDD_USB_INT_LEVEL       USB_INTLVL_LO_gc
+
 #define UDI_CDC_ENABLE_EXT(port)            cdc_enable(port)
 #define UDI_CDC_DISABLE_EXT(port)           cdc_disable(port)
 #define UDI_CDC_RX_NOTIFY(port)             cdc_data_received(port)
 #define UDI_CDC_SET_CODING_EXT(port,cfg)    cdc_uart_config(port,cfg)
 #define UDI_CDC_SET_DTR_EXT(port,set)       cdc_set_dtr(port,set)
 #define UDI_CDC_SET_RTS_EXT(port,set)       cdc_set_rts(port,set)
+#define UDC_SOF_EVENT()                     cdc_sof()
+#define USB_DEVICE_SPECIFIC_REQUEST()       cdc_vendor_request()
 
 #define UDI_CDC_DEFAULT_RATE                115200
 #define UDI_CDC_DEFAULT_STOPBITS            CDC_STOP_BITS_1
@@ -33,5 +53,6 @@
 #include <compiler.h>
 #include "udi_cdc_conf.h"
 #include "main.h"
+#include "stats.h"
 
 #endif /* ___n_conf_usb_h__ */
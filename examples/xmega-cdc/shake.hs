@@ -14,18 +14,46 @@ buildRoot       = "build"
 
 localBuildDir   = buildRoot </> "local"
 asfBuildDir     = buildRoot </> "asf"
+genDir          = buildRoot </> "gen"
+
+-- USART baud settings, looked up by cdc_uart_config
+baudTable       = genDir </> "baud_table.h"
 
 elfFile         = "cdc.elf"
 mapFile         = "cdc.map"
 
 device          = "atxmega128a4u"
 
+-- peripheral clock: must match conf/conf_clock.h (48MHz RC oscillator,
+-- prescaled by 2)
+perClock        = 24000000
+
 avrdudeFlags    = ["-c", "dragon_pdi"]
 
+-- USB_DEVICE_VENDOR_ID and USB_DEVICE_PRODUCT_ID in conf/conf_usb.h
+usbVendor       = 0x03eb
+usbProduct      = 0x2404
+
+-- "latency" benchmarks round trips through port 0 (with PC2 and PC3
+-- jumpered together) twice: with low-latency mode off (latency-off.txt)
+-- and on (latency.txt), sent on after 2 idle ticks (500us at the
+-- default CDC_LATENCY_TICK_US) or once 32 bytes are waiting.
+-- "latency-loopback" runs the same benchmark with no device at all,
+-- for a baseline.
+bridgeTTY       = "/dev/ttyACM0"
+latencyIdle     = 2
+latencyBytes    = 32
+
+-- host tests, against stand-ins for the hardware and ASF (test/stub)
+testDir         = "test"
+testBuildDir    = buildRoot </> "test"
+hostTests       = ["rx_dma_test"]
+hostCFlags      = ["-std=gnu99", "-Wall", "-Wno-pointer-to-int-cast", "-O2", "-I" ++ testDir </> "stub", "-I" ++ srcDir]
+
 commonFlags     = ["-pipe", "-mmcu=" ++ device] ++ optFlags
 optFlags        = ["-Os", "-ffunction-sections", "-fdata-sections"]
 
-cppFlags        = ["-Iconf", "-Isrc"] ++ asfDefines ++ map (("-I" ++) . (asfDir </>)) asfIncludes
+cppFlags        = ["-Iconf", "-Isrc", "-I" ++ genDir] ++ asfDefines ++ map (("-I" ++) . (asfDir </>)) asfIncludes
 
 cFlags = commonFlags ++ cppFlags ++ ["-Wall", "-Werror", "-mrelax", "-std=gnu99"]
 
@@ -33,6 +61,13 @@ asFlags = commonFlags ++ cppFlags
     ++ ["-x", "assembler-with-cpp", "-mrelax", "-D__ASSEMBLY__"]
     ++ map (("-Wa,-I" ++) . (asfDir </>)) asfIncludes
 
+pchHeader       = "conf/conf_pch.h"
+pch             = pchPath (buildRoot </> "pch") cFlags pchHeader
+
+-- "pch-report" compiles this one with and without the precompiled
+-- header, to measure what it saves on each of the C sources
+pchSample       = "common/services/usb/udc/udc.c"
+
 ldFlags = commonFlags ++ ["-Wl,--relax", "-Wl,--gc-sections", "-Wl,--section-start=.BOOT=0x20000"]
     ++ ["-Wl,-Map=" ++ mapFile ++ ",--cref"]
 
@@ -75,9 +110,12 @@ asfSources =
 
 -- defines rules to compile from a source dir to a build dir, mirroring
 -- the directory layout, appending '.o' to all source names, and
--- invoking known compilers as needed.
-compileRules fromDir toDir = 
+-- invoking known compilers as needed.  'gens' are generated headers the
+-- sources include, which have to exist before their dependencies can be
+-- scanned.
+compileRules gens fromDir toDir = 
     toDir ++ "//*.o" *> \out -> do
+        need gens
         src <- case stripPrefix toDir (dropExtension out) of
             Just ('/':rest) -> return (fromDir </> rest)
             _               -> fail $ unwords
@@ -85,7 +123,7 @@ compileRules fromDir toDir =
                 "which does not start with", show toDir]
         
         case takeExtension src of
-            ".c" -> avr_gcc cFlags src out
+            ".c" -> avr_gcc_pch pch cFlags src out
             ".s" -> avr_gcc asFlags src out
             _   -> fail ("don't know how to compile this source: " ++ show src)
 
@@ -93,9 +131,34 @@ main = shakeArgs shakeOptions $ do
     want ["size"]
     
     "size"      ~> avr_size elfFile
-    "clean"     ~> removeFilesAfter "." [elfFile, mapFile, buildRoot]
+    "pch-report" ~> do
+        need [asfDir]
+        localSources <- getDirectoryFiles srcDir ["//*.c"]
+        let cSources = localSources ++ filter ((".c" ==) . takeExtension) asfSources
+        avr_pch_report cFlags pch (asfDir </> pchSample) cSources
+    "clean"     ~> removeFilesAfter "." [elfFile, mapFile, buildRoot, "stats.txt", "latency*.txt"]
     "veryclean" ~> do need ["clean"]; removeFilesAfter "." [asfDir]
     "flash"     ~> avrdude device avrdudeFlags (w Application elfFile)
+    "stats"     ~> bridge_stats usbVendor usbProduct True "stats.txt"
+    
+    "latency"   ~> do
+        bridge_latency usbVendor usbProduct 0 0 0
+        serial_latency bridgeTTY 115200 8 1000 "latency-off.txt"
+        bridge_latency usbVendor usbProduct 0 latencyIdle latencyBytes
+        serial_latency bridgeTTY 115200 8 1000 "latency.txt"
+    "latency-loopback" ~> loopback_latency 8 1000 "latency-loopback.txt"
+    
+    "test"      ~> do
+        let tests = map (testBuildDir </>) hostTests
+        need tests
+        mapM_ (\test -> command_ [] test []) tests
+    
+    testBuildDir ++ "//*" *> \out -> do
+        stubs <- getDirectoryFiles "" [testDir ++ "//*.h"]
+        sources <- getDirectoryFiles "" [srcDir ++ "//*.c", srcDir ++ "//*.h"]
+        let test = testDir </> takeFileName out <.> "c"
+        need (test : stubs ++ sources)
+        command_ [] "cc" (hostCFlags ++ [test, "-o", out])
             
     "fuses"     ~> do
         avrdude device avrdudeFlags $ sequence_
@@ -114,5 +177,9 @@ main = shakeArgs shakeOptions $ do
             asfObjs   = [asfBuildDir   </> src <.> "o" | src <- asfSources]
         avr_ld' "avr-gcc" ldFlags (localObjs ++ asfObjs) elfFile
     
-    compileRules asfDir asfBuildDir
-    compileRules srcDir localBuildDir
+    [pch, pch <.> "gch"] &*> \_ -> avr_pch cFlags pchHeader pch
+    
+    baudTable *> avr_baud_header perClock 0.01 standardBaudRates
+    
+    compileRules []          asfDir asfBuildDir
+    compileRules [baudTable] srcDir localBuildDir
@@ -0,0 +1,90 @@
+#include "handshake.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <board.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <udi_cdc.h>
+
+struct handshake_pins
+{
+    PORT_t     *port;
+    uint8_t     rts;
+    uint8_t     cts;
+};
+
+static const struct handshake_pins handshake_pins[UDI_CDC_PORT_NB] = BOARD_HANDSHAKE_PINS;
+
+// per port, bitwise
+static uint8_t host_rts = 0;
+static uint8_t rx_room  = 0xff;
+
+static void update_rts(uint8_t port)
+{
+    const struct handshake_pins *pins = handshake_pins + port;
+    
+    if (host_rts & rx_room & (1 << port))   pins->port->OUTCLR = pins->rts;
+    else                                    pins->port->OUTSET = pins->rts;
+}
+
+void handshake_init(void)
+{
+    for (uint8_t port = 0; port < UDI_CDC_PORT_NB; port++)
+    {
+        const struct handshake_pins *pins = handshake_pins + port;
+        
+        pins->port->OUTSET = pins->rts;
+        pins->port->DIRSET = pins->rts;
+        
+        // interrupt when CTS is asserted
+        pins->port->DIRCLR = pins->cts;
+        PORTCFG.MPCMASK = pins->cts;
+        pins->port->PIN0CTRL = PORT_OPC_PULLDOWN_gc | PORT_ISC_FALLING_gc;
+        pins->port->INT0MASK |= pins->cts;
+        pins->port->INTCTRL = (pins->port->INTCTRL & ~PORT_INT0LVL_gm) | PORT_INT0LVL_HI_gc;
+    }
+}
+
+bool handshake_cts(uint8_t port)
+{
+    const struct handshake_pins *pins = handshake_pins + port;
+    
+    return !(pins->port->IN & pins->cts);
+}
+
+void handshake_host_rts(uint8_t port, bool asserted)
+{
+    irqflags_t flags = cpu_irq_save();
+    
+    if (asserted)   host_rts |=   1 << port;
+    else            host_rts &= ~(1 << port);
+    update_rts(port);
+    
+    cpu_irq_restore(flags);
+}
+
+void handshake_rx_room(uint8_t port, bool room)
+{
+    irqflags_t flags = cpu_irq_save();
+    
+    if (room)   rx_room |=   1 << port;
+    else        rx_room &= ~(1 << port);
+    update_rts(port);
+    
+    cpu_irq_restore(flags);
+}
+
+static void cts_asserted(PORT_t *port)
+{
+    for (uint8_t i = 0; i < UDI_CDC_PORT_NB; i++)
+    {
+        const struct handshake_pins *pins = handshake_pins + i;
+        
+        if (pins->port == port && !(port->IN & pins->cts)) cdc_data_received(i);
+    }
+}
+
+ISR(PORTC_INT0_vect) { cts_asserted(&PORTC); }
+ISR(PORTD_INT0_vect) { cts_asserted(&PORTD); }
+ISR(PORTE_INT0_vect) { cts_asserted(&PORTE); }
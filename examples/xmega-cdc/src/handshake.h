@@ -0,0 +1,23 @@
+#ifndef ___n_handshake_h__
+#define ___n_handshake_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// RTS/CTS hardware flow control on the bridge ports (pins in
+// conf_board.h).
+//
+// RTS tells the attached device we can take more: it's asserted when
+// the host has asserted RTS (SET_CONTROL_LINE_STATE) and the port's
+// receive path has room, as last reported by handshake_rx_room.
+//
+// CTS gates transmission: the USART's DRE handler checks handshake_cts
+// before each byte and stops when it's deasserted, and CTS being
+// asserted again calls cdc_data_received to restart it.
+
+void handshake_init(void);
+bool handshake_cts(uint8_t port);
+void handshake_host_rts(uint8_t port, bool asserted);
+void handshake_rx_room(uint8_t port, bool room);
+
+#endif /* ___n_handshake_h__ */
@@ -9,9 +9,15 @@
 #include <stdint.h>
 #include <sysclk.h>
 #include <udc.h>
+#include <udd.h>
 #include <udi_cdc.h>
 #include <avr/pgmspace.h>
 
+#include "baud_table.h"
+#include "handshake.h"
+#include "rx_dma.h"
+#include "stats.h"
+
 FUSES =
 {
     .FUSEBYTE1 = FUSE1_DEFAULT,
@@ -26,6 +32,22 @@ static const USART_t * const port_usarts[UDI_CDC_PORT_NB] PROGMEM =
 };
 static usart_rs232_options_t port_configurations[UDI_CDC_PORT_NB];
 
+// with RX DMA, received bytes don't interrupt at all
+#if CDC_RX_DMA_SIZE
+#define USART_RXCINTLVL_gc  USART_RXCINTLVL_OFF_gc
+#else
+#define USART_RXCINTLVL_gc  USART_RXCINTLVL_HI_gc
+#endif
+
+// data from the host, taken from UDI CDC a buffer at a time and sent
+// from there by the USART's DRE interrupt
+struct tx_buf
+{
+    uint8_t data[CDC_TX_BUF_SIZE];
+    uint8_t pos, len;
+};
+static struct tx_buf tx_bufs[UDI_CDC_PORT_NB];
+
 int main(void)
 {
     sysclk_init();
@@ -36,10 +58,12 @@ int main(void)
     cpu_irq_enable();
     
     // TODO: pull into board-init?
-    // TODO: set up pins for RTS/DTR
+    // TODO: set up pins for DTR
     PORTC.DIRSET = PIN3_bm | PIN7_bm;
     PORTD.DIRSET = PIN3_bm | PIN7_bm;
     PORTE.DIRSET = PIN3_bm;
+    handshake_init();
+    stats_init();
     
     // initialize port configurations
     // TODO: save in EEPROM
@@ -52,6 +76,9 @@ int main(void)
     for (uint8_t port = 0; port < UDI_CDC_PORT_NB; port++)
     {
         cdc_uart_config(port, &default_port_config);
+#if CDC_RX_DMA_SIZE
+        rx_dma_set_latency(port, CDC_LATENCY_IDLE, CDC_LATENCY_THRESHOLD);
+#endif
     }
     
     udc_start();
@@ -72,14 +99,69 @@ USART_t *get_port_usart(uint8_t port)
     return usart;
 }
 
+#if BAUD_F_PER != F_CPU
+#error "baud_table.h was generated for a different clock (see shake.hs)"
+#endif
+
+// BAUDCTRLB:A and CLK2X for a rate from the generated table (see
+// shake.hs), or false if it's not there
+static bool lookup_baud(uint32_t rate, uint16_t *ctrl, bool *clk2x)
+{
+    for (uint8_t i = 0; i < BAUD_RATES; i++)
+    {
+        if (pgm_read_dword(baud_rates + i) == rate)
+        {
+            *ctrl   = pgm_read_word(baud_ctrl + i);
+            *clk2x  = pgm_read_byte(baud_clk2x + i);
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+// usart_init_rs232, but with the baud rate from the table when it's
+// there (any other rate still goes through usart_init_rs232's search)
+static bool cdc_usart_init(USART_t *usart, const usart_rs232_options_t *opt)
+{
+    uint16_t ctrl;
+    bool clk2x;
+    
+    sysclk_enable_peripheral_clock(usart);
+    
+    if (!lookup_baud(opt->baudrate, &ctrl, &clk2x))
+    {
+        usart->CTRLB &= ~USART_CLK2X_bm;
+        return usart_init_rs232(usart, opt);
+    }
+    
+    usart_set_mode(usart, USART_CMODE_ASYNCHRONOUS_gc);
+    usart_format_set(usart, opt->charlength, opt->paritytype, opt->stopbits);
+    
+    // writing BAUDCTRLA updates the baud rate, so it goes last
+    usart->BAUDCTRLB = ctrl >> 8;
+    usart->BAUDCTRLA = ctrl;
+    if (clk2x)  usart->CTRLB |=  USART_CLK2X_bm;
+    else        usart->CTRLB &= ~USART_CLK2X_bm;
+    
+    usart_tx_enable(usart);
+    usart_rx_enable(usart);
+    
+    return true;
+}
+
 bool cdc_enable(uint8_t port)
 {
     USART_t *usart = get_port_usart(port);
     if (usart == NULL) return false;
     
-    if (!usart_init_rs232(usart, port_configurations + port)) return false;
+    if (!cdc_usart_init(usart, port_configurations + port)) return false;
     
-    usart->CTRLA = USART_RXCINTLVL_HI_gc | USART_DREINTLVL_HI_gc;
+    tx_bufs[port].pos = tx_bufs[port].len = 0;
+#if CDC_RX_DMA_SIZE
+    rx_dma_start(port, usart);
+#endif
+    usart->CTRLA = USART_RXCINTLVL_gc | USART_DREINTLVL_HI_gc;
     
     return true;
 }
@@ -90,15 +172,19 @@ void cdc_disable(uint8_t port)
     if (usart == NULL) return;
     
     usart->CTRLA = USART_RXCINTLVL_OFF_gc | USART_DREINTLVL_OFF_gc;
+#if CDC_RX_DMA_SIZE
+    rx_dma_stop(port);
+#endif
     
     usart_tx_disable(usart);
     usart_rx_disable(usart);
     sysclk_disable_peripheral_clock(usart);
 }
 
+// (not CTRLA: with RX DMA, that's 0 whenever there's nothing to send)
 static bool cdc_usart_is_enabled(const USART_t * const usart)
 {
-    return usart->CTRLA != 0;
+    return usart->CTRLB & (USART_RXEN_bm | USART_TXEN_bm);
 }
 
 static USART_CHSIZE_t lookup_charlength(uint8_t bits)
@@ -138,7 +224,7 @@ void cdc_uart_config(uint8_t port, const usb_cdc_line_coding_t * cfg)
         stopbits:   cfg->bCharFormat == CDC_STOP_BITS_2,
     };
     
-    if (cdc_usart_is_enabled(usart)) usart_init_rs232(usart, port_configurations + port);
+    if (cdc_usart_is_enabled(usart)) cdc_usart_init(usart, port_configurations + port);
 }
 
 void cdc_data_received(uint8_t port)
@@ -149,10 +235,56 @@ void cdc_data_received(uint8_t port)
     if (cdc_usart_is_enabled(usart))
     {
         // Enable UART TX interrupt to send values
-        usart->CTRLA = USART_RXCINTLVL_HI_gc | USART_DREINTLVL_HI_gc;
+        usart->CTRLA = USART_RXCINTLVL_gc | USART_DREINTLVL_HI_gc;
     }
 }
 
+// every USB frame (1ms): pass on what the RX DMA has collected, and
+// update RTS.  With RX DMA, RTS is deasserted once the ring is half
+// full, which leaves the device most of a frame (plus the rest of the
+// ring) to notice.
+void cdc_sof(void)
+{
+    for (uint8_t port = 0; port < UDI_CDC_PORT_NB; port++)
+    {
+        if (!cdc_usart_is_enabled(get_port_usart(port))) continue;
+        
+        uint16_t start = stats_now();
+#if CDC_RX_DMA_SIZE
+        handshake_rx_room(port, rx_dma_drain(port) < CDC_RX_DMA_SIZE / 2);
+#else
+        handshake_rx_room(port, udi_cdc_multi_is_tx_ready(port));
+#endif
+        stats_isr_time(port, start);
+    }
+}
+
+// Vendor control requests: reading the counters (see stats.h), and
+// setting a port's latency mode (see rx_dma.h), with bmRequestType
+// 0x40, bRequest CDC_LATENCY_REQUEST, wIndex the port and wValue the
+// idle limit in the low byte and the threshold in the high byte.
+bool cdc_vendor_request(void)
+{
+    if (stats_request()) return true;
+    
+#if CDC_RX_DMA_SIZE
+    const uint8_t type = USB_REQ_DIR_OUT | USB_REQ_TYPE_VENDOR | USB_REQ_RECIP_DEVICE;
+    
+    if (udd_g_ctrlreq.req.bmRequestType == type
+        && udd_g_ctrlreq.req.bRequest == CDC_LATENCY_REQUEST
+        && udd_g_ctrlreq.req.wIndex < UDI_CDC_PORT_NB
+        && udd_g_ctrlreq.req.wLength == 0)
+    {
+        uint16_t value = udd_g_ctrlreq.req.wValue;
+        
+        rx_dma_set_latency(udd_g_ctrlreq.req.wIndex, value, value >> 8);
+        return true;
+    }
+#endif
+    
+    return false;
+}
+
 void cdc_set_dtr(uint8_t port, bool b_enable)
 {
     USART_t *usart = get_port_usart(port);
@@ -166,40 +298,69 @@ void cdc_set_dtr(uint8_t port, bool b_enable)
 
 void cdc_set_rts(uint8_t port, bool b_enable)
 {
-    USART_t *usart = get_port_usart(port);
-    if (usart == NULL) return;
+    if (port >= UDI_CDC_PORT_NB) return;
     
-    if (cdc_usart_is_enabled(usart))
+    handshake_host_rts(port, b_enable);
+}
+
+// next byte to send on a port, or -1 if there's nothing to send or CTS
+// isn't asserted
+static int16_t tx_next(uint8_t port)
+{
+    struct tx_buf *tx = tx_bufs + port;
+    
+    if (!handshake_cts(port)) return -1;
+    
+    if (tx->pos == tx->len)
     {
-        // do something
+        iram_size_t n = udi_cdc_multi_get_nb_received_data(port);
+        if (n > sizeof tx->data) n = sizeof tx->data;
+        
+        tx->pos = 0;
+        tx->len = n ? n - udi_cdc_multi_read_buf(port, tx->data, n) : 0;
+        if (tx->len == 0) return -1;
+        
+        port_stats[port].tx_bytes += tx->len;
+        stats_high_water(&port_stats[port].tx_high_water, tx->len);
     }
+    
+    return tx->data[tx->pos++];
 }
 
 #define USART_ISRS(port,usart)                                              \
     ISR(usart ## _RXC_vect)                                                 \
     {                                                                       \
+        uint16_t start = stats_now();                                       \
         uint8_t in_byte = usart.DATA;                                       \
                                                                             \
         if (usart.STATUS & (USART_FERR_bm | USART_BUFOVF_bm)) {             \
             udi_cdc_multi_signal_framing_error(port);                       \
+            stats_count(&port_stats[port].framing_errors);                  \
         }                                                                   \
                                                                             \
         if (udi_cdc_multi_is_tx_ready(port))                                \
         {                                                                   \
             udi_cdc_multi_putc(port, in_byte);                              \
+            port_stats[port].rx_bytes++;                                    \
         }                                                                   \
         else                                                                \
         {                                                                   \
             udi_cdc_multi_signal_overrun(port);                             \
+            stats_count(&port_stats[port].overruns);                        \
         }                                                                   \
+        stats_isr_time(port, start);                                        \
     }                                                                       \
     ISR(usart ## _DRE_vect)                                                 \
     {                                                                       \
-        if (udi_cdc_multi_is_rx_ready(port)) {                              \
-            usart.DATA = udi_cdc_multi_getc(port);                          \
+        uint16_t start = stats_now();                                       \
+        int16_t out_byte = tx_next(port);                                   \
+                                                                            \
+        if (out_byte >= 0) {                                                \
+            usart.DATA = out_byte;                                          \
         } else {                                                            \
-            usart.CTRLA = USART_RXCINTLVL_HI_gc | USART_DREINTLVL_OFF_gc;   \
+            usart.CTRLA = USART_RXCINTLVL_gc | USART_DREINTLVL_OFF_gc;      \
         }                                                                   \
+        stats_isr_time(port, start);                                        \
     }
 
 
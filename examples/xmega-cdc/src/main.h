@@ -14,5 +14,7 @@ void cdc_uart_config(uint8_t port, const usb_cdc_line_coding_t * cfg);
 void cdc_data_received(uint8_t port);
 void cdc_set_dtr(uint8_t port, bool b_enable);
 void cdc_set_rts(uint8_t port, bool b_enable);
+void cdc_sof(void);
+bool cdc_vendor_request(void);
 
 #endif /* ___n_main_h__ */
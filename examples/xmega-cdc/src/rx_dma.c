@@ -0,0 +1,258 @@
+#include "rx_dma.h"
+#include "stats.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sysclk.h>
+#include <udi_cdc.h>
+
+#if CDC_RX_DMA_SIZE
+
+#if CDC_RX_DMA_SIZE > 128 || (CDC_RX_DMA_SIZE & (CDC_RX_DMA_SIZE - 1))
+#error "CDC_RX_DMA_SIZE must be a power of 2, at most 128"
+#endif
+
+#if UDI_CDC_PORT_NB > 4
+#error "RX DMA needs a DMA channel per port, and there are only 4"
+#endif
+
+// Each channel runs one block of CDC_RX_DMA_SIZE single-byte bursts,
+// triggered by its USART's RXC, repeated forever and reloading the
+// destination address after each block.  Its transaction-complete flag
+// is set at the end of every block in that mode, which is counted in
+// 'wraps'; together with the position in the block (from TRFCNT) that
+// gives a count of bytes received, modulo 256 blocks.
+struct rx_dma
+{
+    uint8_t             ring[CDC_RX_DMA_SIZE];
+    volatile uint8_t    wraps;
+    uint16_t            taken;      // bytes handed on to UDI CDC
+
+    // low-latency mode (see rx_dma_set_latency); idle_limit 0 is off
+    uint8_t             idle_limit, threshold;
+    uint8_t             idle;       // ticks since 'seen' last changed
+    uint16_t            seen;
+};
+
+#define RX_DMA_COUNT_MASK   (256u * CDC_RX_DMA_SIZE - 1)
+
+static struct rx_dma rx_dma[UDI_CDC_PORT_NB];
+
+static DMA_CH_t * const rx_dma_channels[4] =
+{
+    &DMA.CH0, &DMA.CH1, &DMA.CH2, &DMA.CH3
+};
+
+// in port order; see port_usarts in main.c
+static const uint8_t rx_dma_triggers[4] PROGMEM =
+{
+    DMA_CH_TRIGSRC_USARTC0_RXC_gc,
+    DMA_CH_TRIGSRC_USARTC1_RXC_gc,
+    DMA_CH_TRIGSRC_USARTD0_RXC_gc,
+    DMA_CH_TRIGSRC_USARTE0_RXC_gc,
+};
+
+void rx_dma_start(uint8_t port, USART_t *usart)
+{
+    DMA_CH_t *ch = rx_dma_channels[port];
+    uint16_t src = (uint16_t) &usart->DATA;
+    uint16_t dst = (uint16_t) rx_dma[port].ring;
+
+    sysclk_enable_module(SYSCLK_PORT_GEN, SYSCLK_DMA);
+    DMA.CTRL |= DMA_ENABLE_bm;
+
+    ch->CTRLA = 0;
+    ch->CTRLA = DMA_CH_RESET_bm;
+
+    rx_dma[port].wraps = 0;
+    rx_dma[port].taken = 0;
+
+    ch->ADDRCTRL    = DMA_CH_SRCRELOAD_NONE_gc  | DMA_CH_SRCDIR_FIXED_gc
+                    | DMA_CH_DESTRELOAD_BLOCK_gc | DMA_CH_DESTDIR_INC_gc;
+    ch->TRIGSRC     = pgm_read_byte(rx_dma_triggers + port);
+    ch->TRFCNT      = CDC_RX_DMA_SIZE;
+    ch->REPCNT      = 0; // with REPEAT: forever
+
+    ch->SRCADDR0    = src;
+    ch->SRCADDR1    = src >> 8;
+    ch->SRCADDR2    = 0;
+    ch->DESTADDR0   = dst;
+    ch->DESTADDR1   = dst >> 8;
+    ch->DESTADDR2   = 0;
+
+    ch->CTRLB       = DMA_CH_TRNINTLVL_HI_gc;
+    ch->CTRLA       = DMA_CH_ENABLE_bm | DMA_CH_REPEAT_bm | DMA_CH_SINGLE_bm
+                    | DMA_CH_BURSTLEN_1BYTE_gc;
+}
+
+void rx_dma_stop(uint8_t port)
+{
+    DMA_CH_t *ch = rx_dma_channels[port];
+
+    ch->CTRLA = 0;
+    ch->CTRLB = DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm;
+}
+
+// bytes received so far (modulo 256 blocks)
+static uint16_t rx_dma_received(uint8_t port)
+{
+    DMA_CH_t *ch = rx_dma_channels[port];
+    struct rx_dma *rx = rx_dma + port;
+    irqflags_t flags = cpu_irq_save();
+    uint16_t left;
+
+    // a block may have ended while interrupts were off (or end between
+    // the two checks, in which case TRFCNT has to be read again)
+    for (;;)
+    {
+        if (ch->CTRLB & DMA_CH_TRNIF_bm)
+        {
+            ch->CTRLB = DMA_CH_TRNIF_bm | DMA_CH_TRNINTLVL_HI_gc;
+            rx->wraps++;
+        }
+
+        left = ch->TRFCNT;
+        if (!(ch->CTRLB & DMA_CH_TRNIF_bm)) break;
+    }
+
+    uint16_t received = (uint16_t) rx->wraps * CDC_RX_DMA_SIZE + (CDC_RX_DMA_SIZE - left);
+    cpu_irq_restore(flags);
+
+    return received & RX_DMA_COUNT_MASK;
+}
+
+uint8_t rx_dma_drain(uint8_t port)
+{
+    struct rx_dma *rx = rx_dma + port;
+    struct port_stats *stats = port_stats + port;
+    uint16_t available = (rx_dma_received(port) - rx->taken) & RX_DMA_COUNT_MASK;
+
+    if (available > CDC_RX_DMA_SIZE)
+    {
+        // the ring has wrapped around on data that hadn't been sent yet;
+        // skip to the oldest byte that's still there
+        udi_cdc_multi_signal_overrun(port);
+        stats_count(&stats->overruns);
+        rx->taken += available - CDC_RX_DMA_SIZE;
+        available = CDC_RX_DMA_SIZE;
+    }
+    stats_high_water(&stats->rx_high_water, available);
+
+    // never more than UDI CDC can take without waiting: this runs in the
+    // USB interrupt
+    while (available)
+    {
+        uint8_t tail = rx->taken & (CDC_RX_DMA_SIZE - 1);
+        iram_size_t n = udi_cdc_multi_get_free_tx_buffer(port);
+
+        if (n == 0) break;
+        if (n > available) n = available;
+        if (n > CDC_RX_DMA_SIZE - tail) n = CDC_RX_DMA_SIZE - tail;
+
+        // write_buf returns what it didn't take; if that's everything
+        // (the port's been closed, say) there's no point trying again now
+        n -= udi_cdc_multi_write_buf(port, rx->ring + tail, n);
+        if (n == 0) break;
+        
+        rx->taken += n;
+        stats->rx_bytes += n;
+        available -= n;
+    }
+
+    return available;
+}
+
+// Low-latency mode: UDI CDC sends a partial packet at the first SOF
+// after it gets it, and rx_dma_drain runs just after UDI CDC's SOF
+// handling, so bytes that arrive during a frame normally go out two
+// SOFs later.  A port in this mode is checked every CDC_LATENCY_TICK_US
+// instead, and drained as soon as the line has been idle for
+// 'idle_limit' ticks or 'threshold' bytes are waiting, which saves one
+// of those frames.  The tick runs at the USB interrupt's level, so it
+// can't interrupt (or be interrupted by) the SOF drain.
+
+#define RX_DMA_TICK_PER ((uint16_t) (F_CPU / 1000000UL * CDC_LATENCY_TICK_US - 1))
+
+void rx_dma_set_latency(uint8_t port, uint8_t idle_limit, uint8_t threshold)
+{
+    bool any = false;
+
+    irqflags_t flags = cpu_irq_save();
+    rx_dma[port].idle_limit = idle_limit;
+    rx_dma[port].threshold  = threshold;
+    rx_dma[port].idle       = 0;
+    cpu_irq_restore(flags);
+
+    for (uint8_t i = 0; i < UDI_CDC_PORT_NB; i++)
+    {
+        if (rx_dma[i].idle_limit) any = true;
+    }
+
+    if (any && !(TCD1.CTRLA & TC1_CLKSEL_gm))
+    {
+        sysclk_enable_module(SYSCLK_PORT_D, SYSCLK_TC1);
+        TCD1.PER        = RX_DMA_TICK_PER;
+        TCD1.CNT        = 0;
+        TCD1.INTCTRLA   = TC_OVFINTLVL_LO_gc;
+        TCD1.CTRLA      = TC_CLKSEL_DIV1_gc;
+    }
+    else if (!any)
+    {
+        TCD1.CTRLA      = TC_CLKSEL_OFF_gc;
+        TCD1.INTCTRLA   = TC_OVFINTLVL_OFF_gc;
+    }
+}
+
+ISR(TCD1_OVF_vect)
+{
+    for (uint8_t port = 0; port < UDI_CDC_PORT_NB; port++)
+    {
+        struct rx_dma *rx = rx_dma + port;
+
+        if (!rx->idle_limit) continue;
+        if (!(rx_dma_channels[port]->CTRLA & DMA_CH_ENABLE_bm)) continue;
+
+        uint16_t received = rx_dma_received(port);
+        uint16_t waiting = (received - rx->taken) & RX_DMA_COUNT_MASK;
+
+        if (received != rx->seen)
+        {
+            rx->seen = received;
+            rx->idle = 0;
+        }
+        else if (rx->idle != 0xFF)
+        {
+            rx->idle++;
+        }
+
+        if (waiting == 0) continue;
+        if (rx->idle >= rx->idle_limit || (rx->threshold && waiting >= rx->threshold))
+        {
+            rx_dma_drain(port);
+        }
+    }
+}
+
+#define RX_DMA_ISR(n)                                                       \
+    ISR(DMA_CH ## n ## _vect)                                               \
+    {                                                                       \
+        DMA.CH ## n.CTRLB = DMA_CH_TRNIF_bm | DMA_CH_TRNINTLVL_HI_gc;       \
+        rx_dma[n].wraps++;                                                  \
+    }
+
+RX_DMA_ISR(0)
+#if UDI_CDC_PORT_NB > 1
+RX_DMA_ISR(1)
+#endif
+#if UDI_CDC_PORT_NB > 2
+RX_DMA_ISR(2)
+#endif
+#if UDI_CDC_PORT_NB > 3
+RX_DMA_ISR(3)
+#endif
+
+#endif /* CDC_RX_DMA_SIZE */
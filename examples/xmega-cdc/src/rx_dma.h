@@ -0,0 +1,31 @@
+#ifndef ___n_rx_dma_h__
+#define ___n_rx_dma_h__
+
+#include <avr/io.h>
+#include <stdint.h>
+
+// DMA-driven USART receive: each port's DMA channel copies received
+// bytes into a ring in SRAM with no per-byte interrupt, and
+// rx_dma_drain (on every USB start-of-frame) hands whatever has arrived
+// to UDI CDC in at most two bulk writes.
+//
+// CDC_RX_DMA_SIZE (conf_usb.h) is the ring size per port, a power of
+// 2 up to 128; 0 selects the original per-byte RXC interrupts instead.
+// Drained once a frame, a port overruns once more than that arrives in
+// a millisecond: test/rx_dma_test.c simulates a 128-byte ring keeping
+// up at 1.2 Mbaud (120 bytes a frame) and losing data at 1.5 Mbaud.
+
+void rx_dma_start(uint8_t port, USART_t *usart);
+void rx_dma_stop(uint8_t port);
+uint8_t rx_dma_drain(uint8_t port); // returns bytes still waiting
+
+// vendor control request setting the latency mode (see main.c)
+#define CDC_LATENCY_REQUEST 0x02
+
+// Low-latency mode for a port: hand received bytes to UDI CDC as soon
+// as the line has been idle for 'idle_limit' ticks (CDC_LATENCY_TICK_US
+// each), or once 'threshold' bytes (if nonzero) are waiting, rather
+// than at the next SOF.  An 'idle_limit' of 0 turns it off.
+void rx_dma_set_latency(uint8_t port, uint8_t idle_limit, uint8_t threshold);
+
+#endif /* ___n_rx_dma_h__ */
@@ -0,0 +1,66 @@
+#include "stats.h"
+
+#include <avr/io.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sysclk.h>
+#include <udd.h>
+#include <udi_cdc.h>
+#include <usb_protocol.h>
+
+struct port_stats port_stats[UDI_CDC_PORT_NB];
+
+// what goes out in the data stage; it has to stay put until the
+// transfer is done, so the counters are copied here rather than sent
+// from where they're being updated
+static struct
+{
+    uint8_t             version;
+    uint8_t             ports;
+    uint8_t             size;
+    uint8_t             mhz;
+    struct port_stats   stats[UDI_CDC_PORT_NB];
+} stats_reply;
+
+void stats_init(void)
+{
+    sysclk_enable_module(SYSCLK_PORT_E, SYSCLK_TC0);
+    TCE0.PER    = 0xFFFF;
+    TCE0.CTRLA  = TC_CLKSEL_DIV1_gc;
+}
+
+// the handlers that call this run at different interrupt levels
+void stats_isr_time(uint8_t port, uint16_t start)
+{
+    uint16_t elapsed = stats_now() - start;
+    irqflags_t flags = cpu_irq_save();
+    
+    if (elapsed > port_stats[port].isr_max) port_stats[port].isr_max = elapsed;
+    
+    cpu_irq_restore(flags);
+}
+
+bool stats_request(void)
+{
+    const uint8_t type = USB_REQ_DIR_IN | USB_REQ_TYPE_VENDOR | USB_REQ_RECIP_DEVICE;
+    
+    if (udd_g_ctrlreq.req.bmRequestType != type) return false;
+    if (udd_g_ctrlreq.req.bRequest != CDC_STATS_REQUEST) return false;
+    
+    stats_reply.version = CDC_STATS_VERSION;
+    stats_reply.ports   = UDI_CDC_PORT_NB;
+    stats_reply.size    = sizeof (struct port_stats);
+    stats_reply.mhz     = F_CPU / 1000000UL;
+    
+    irqflags_t flags = cpu_irq_save();
+    memcpy(stats_reply.stats, port_stats, sizeof port_stats);
+    if (udd_g_ctrlreq.req.wValue & 1) memset(port_stats, 0, sizeof port_stats);
+    cpu_irq_restore(flags);
+    
+    uint16_t size = sizeof stats_reply;
+    if (size > udd_g_ctrlreq.req.wLength) size = udd_g_ctrlreq.req.wLength;
+    udd_set_setup_payload((uint8_t *) &stats_reply, size);
+    
+    return true;
+}
@@ -0,0 +1,61 @@
+#ifndef ___n_stats_h__
+#define ___n_stats_h__
+
+#include <avr/io.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Per-port traffic and error counters, for watching how close the
+// bridge is to saturating without a debugger attached.  The host reads
+// them with a vendor control request (USB_DEVICE_SPECIFIC_REQUEST in
+// conf_usb.h):
+//
+//   bmRequestType   0xC0 (device to host, vendor, device)
+//   bRequest        CDC_STATS_REQUEST
+//   wValue          1 to zero the counters once they've been read
+//
+// The reply is a 4-byte header { CDC_STATS_VERSION, port count, size
+// of struct port_stats, F_CPU in MHz } followed by one struct port_stats
+// per port, little-endian (Data.AVR.BridgeStats decodes it).  The
+// 16-bit counters stick at 0xFFFF rather than wrapping.
+//
+// Times are CPU cycles, from TCE0 running free at the CPU clock.
+// Framing errors are only seen by the per-byte RXC interrupt: the RX
+// DMA path never looks at the USART's status.
+
+#define CDC_STATS_REQUEST   0x01
+#define CDC_STATS_VERSION   1
+
+struct port_stats
+{
+    uint32_t    rx_bytes;       // USART to host
+    uint32_t    tx_bytes;       // host to USART
+    uint16_t    overruns;       // times received data was lost
+    uint16_t    framing_errors;
+    uint16_t    isr_max;        // longest time in the port's handlers
+    uint8_t     rx_high_water;  // most bytes waiting in the RX DMA ring
+    uint8_t     tx_high_water;  // most bytes taken into the TX buffer
+};
+
+extern struct port_stats port_stats[];
+
+void stats_init(void);
+bool stats_request(void);
+void stats_isr_time(uint8_t port, uint16_t start);
+
+static inline uint16_t stats_now(void)
+{
+    return TCE0.CNT;
+}
+
+static inline void stats_count(uint16_t *counter)
+{
+    if (*counter != 0xFFFF) ++*counter;
+}
+
+static inline void stats_high_water(uint8_t *mark, uint8_t level)
+{
+    if (level > *mark) *mark = level;
+}
+
+#endif /* ___n_stats_h__ */
@@ -0,0 +1,354 @@
+// Host test for the RX DMA path (src/rx_dma.c), run by "shake test".
+//
+// The DMA channel and UDI CDC are both simulated (see stub/): the
+// channel stores received bytes into the ring and sets TRNIF at the end
+// of each block, and can be told to do so between any two of the code's
+// accesses to its registers, which is how the block-end races in
+// rx_dma_received are exercised.  Each received byte is the low byte of
+// its sequence number, so what reaches UDI CDC shows exactly what was
+// lost or repeated.
+//
+// After the checks it prints simulated throughput: bytes arriving at a
+// given baud rate, drained once per 1ms frame by a host that takes up
+// to HOST_FRAME_BYTES each frame (UDI CDC's two 64-byte bulk buffers).
+
+#include "../src/rx_dma.c"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SIZE                CDC_RX_DMA_SIZE
+#define HOST_FRAME_BYTES    128
+
+DMA_t DMA;
+TC_t TCD1, TCE0;
+struct port_stats port_stats[UDI_CDC_PORT_NB];
+
+static USART_t usart;
+
+// CTRLB_ holds this in its high byte as long as nothing has written it
+// since the simulation last did
+#define SIM_MARK 0xA500
+
+static struct
+{
+    uint32_t    received;       // bytes the channel has stored
+    bool        trnif;
+    unsigned    accesses;       // to CTRLB or TRFCNT, since sim_at
+    unsigned    event_at;
+    uint16_t    event_bytes;
+} sim;
+
+static struct
+{
+    uint16_t    free;           // what get_free_tx_buffer reports
+    uint16_t    take;           // most one write_buf takes
+    uint8_t     out[4 * SIZE];
+    uint16_t    n;              // bytes written (and kept, up to sizeof out)
+    uint32_t    total;
+    uint16_t    writes;
+    uint16_t    overruns;
+    uint16_t    gaps;           // places the sequence skipped
+    uint8_t     next;
+} host;
+
+static const char *test;
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            printf("%s: %s:%d: %s\n", test, __FILE__, __LINE__, #cond);     \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+// bring the registers up to date with the channel, after acting on
+// anything the code wrote to CTRLB (writing TRNIF clears it)
+static void sim_sync(void)
+{
+    DMA_CH_t *ch = &DMA.CH0;
+    uint16_t ctrlb = ch->CTRLB_[0];
+
+    if ((ctrlb & 0xFF00) != SIM_MARK && (ctrlb & DMA_CH_TRNIF_bm)) sim.trnif = false;
+
+    ch->CTRLB_[0]   = SIM_MARK | (sim.trnif ? DMA_CH_TRNIF_bm : 0) | DMA_CH_TRNINTLVL_HI_gc;
+    ch->TRFCNT_[0]  = SIZE - sim.received % SIZE;
+}
+
+// the channel storing 'count' bytes with nothing interrupting it
+static void sim_store(uint16_t count)
+{
+    sim_sync();
+    while (count--)
+    {
+        rx_dma[0].ring[sim.received % SIZE] = (uint8_t) sim.received;
+        if (++sim.received % SIZE == 0) sim.trnif = true;
+    }
+    sim_sync();
+}
+
+// ... and with its handler running at the end of each block
+static void sim_receive(uint32_t count)
+{
+    while (count--)
+    {
+        sim_store(1);
+        if (sim.trnif) dma_ch0_isr();
+    }
+}
+
+// have the channel store 'bytes' just before the code's 'access'th
+// access to CTRLB or TRFCNT from now
+static void sim_at(unsigned access, uint16_t bytes)
+{
+    sim.accesses    = 0;
+    sim.event_at    = access;
+    sim.event_bytes = bytes;
+}
+
+int dma_sim_access(void)
+{
+    sim_sync();
+    if (++sim.accesses == sim.event_at)
+    {
+        sim.event_at = 0;
+        sim_store(sim.event_bytes);
+    }
+
+    return 0;
+}
+
+void udi_cdc_multi_signal_overrun(uint8_t port)
+{
+    host.overruns++;
+}
+
+iram_size_t udi_cdc_multi_get_free_tx_buffer(uint8_t port)
+{
+    return host.free;
+}
+
+iram_size_t udi_cdc_multi_write_buf(uint8_t port, const void *buf, iram_size_t size)
+{
+    const uint8_t *bytes = buf;
+    iram_size_t n = size;
+
+    if (n > host.take) n = host.take;
+    if (n > host.free) n = host.free;
+
+    for (iram_size_t i = 0; i < n; i++)
+    {
+        if (host.n < sizeof host.out) host.out[host.n++] = bytes[i];
+        if (bytes[i] != host.next) host.gaps++;
+        host.next = bytes[i] + 1;
+    }
+    host.free   -= n;
+    host.total  += n;
+    host.writes++;
+
+    return size - n;
+}
+
+static void reset(const char *name)
+{
+    test = name;
+
+    memset(&sim, 0, sizeof sim);
+    memset(&host, 0, sizeof host);
+    memset(rx_dma, 0, sizeof rx_dma);
+    memset(port_stats, 0, sizeof port_stats);
+
+    rx_dma_start(0, &usart);
+    sim_sync();
+
+    host.free = 0xFFFF;
+    host.take = 0xFFFF;
+}
+
+// what reached the host, from 'from' on, is 'count' bytes in sequence
+// starting at 'first'
+static bool host_got(uint16_t from, uint16_t count, uint32_t first)
+{
+    if (host.n != from + count) return false;
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (host.out[from + i] != (uint8_t) (first + i)) return false;
+    }
+
+    return true;
+}
+
+static void test_in_order(void)
+{
+    reset("in order");
+    sim_receive(100);
+    host.free = 64;
+    CHECK(rx_dma_drain(0) == 36);
+    CHECK(host_got(0, 64, 0));
+
+    host.free = 64;
+    CHECK(rx_dma_drain(0) == 0);
+    CHECK(host_got(0, 100, 0));
+    CHECK(port_stats[0].rx_bytes == 100);
+    CHECK(port_stats[0].rx_high_water == 100);
+}
+
+static void test_ring_end(void)
+{
+    reset("split at the end of the ring");
+    sim_receive(SIZE - 10);
+    rx_dma_drain(0);
+
+    host.writes = 0;
+    sim_receive(30);
+    CHECK(rx_dma_drain(0) == 0);
+    CHECK(host.writes == 2);
+    CHECK(host_got(0, SIZE + 20, 0));
+    CHECK(host.overruns == 0);
+}
+
+static void test_lapped(void)
+{
+    reset("lapped once");
+    sim_receive(SIZE + 10);
+    CHECK(rx_dma_drain(0) == 0);
+    CHECK(host.overruns == 1);
+    CHECK(port_stats[0].overruns == 1);
+    CHECK(host_got(0, SIZE, 10));
+
+    // and carries on from there
+    sim_receive(5);
+    rx_dma_drain(0);
+    CHECK(host_got(SIZE, 5, SIZE + 10));
+
+    reset("lapped several times");
+    sim_receive(3);
+    rx_dma_drain(0);
+    sim_receive(5 * SIZE + 3);
+    CHECK(rx_dma_drain(0) == 0);
+    CHECK(host.overruns == 1);
+    CHECK(host_got(3, SIZE, 4 * SIZE + 6));
+}
+
+static void test_block_end_race(void)
+{
+    // accesses in rx_dma_received: 1 reads TRNIF, 2 reads TRFCNT, 3
+    // reads TRNIF again
+    reset("block ends before TRFCNT is read");
+    sim_receive(SIZE - 1);
+    sim_at(2, 1);
+    CHECK(rx_dma_drain(0) == 0);
+    CHECK(host_got(0, SIZE, 0));
+    CHECK(host.overruns == 0);
+
+    reset("block ends after TRFCNT is read");
+    sim_receive(SIZE - 1);
+    sim_at(3, 1);
+    CHECK(rx_dma_drain(0) == 0);
+    CHECK(host_got(0, SIZE, 0));
+    CHECK(host.overruns == 0);
+
+    reset("block ends with TRNIF already set");
+    sim_receive(SIZE - 1);
+    rx_dma_drain(0);
+    sim_store(1);               // handler hasn't run yet
+    sim_at(2, 2);
+    CHECK(rx_dma_drain(0) == 0);
+    CHECK(host_got(0, SIZE + 2, 0));
+    CHECK(rx_dma[0].wraps == 1);
+    CHECK(host.overruns == 0);
+}
+
+static void test_partial_writes(void)
+{
+    reset("partial writes");
+    sim_receive(100);
+    host.free = 64;
+    host.take = 5;
+    CHECK(rx_dma_drain(0) == 36);
+    CHECK(host.writes == 13);
+    CHECK(host_got(0, 64, 0));
+    CHECK(port_stats[0].rx_bytes == 64);
+
+    reset("write refused");
+    sim_receive(100);
+    host.free = 64;
+    host.take = 0;
+    CHECK(rx_dma_drain(0) == 100);
+    CHECK(host.n == 0);
+
+    host.take = 0xFFFF;
+    host.free = 0xFFFF;
+    CHECK(rx_dma_drain(0) == 0);
+    CHECK(host_got(0, 100, 0));
+}
+
+static void test_count_wrap(void)
+{
+    // the received count only goes up to 256 blocks
+    reset("count wraps");
+    for (uint16_t i = 0; i < 600; i++)
+    {
+        sim_receive(97);
+        rx_dma_drain(0);
+    }
+
+    CHECK(host.total == 600 * 97UL);
+    CHECK(host.gaps == 0);
+    CHECK(host.overruns == 0);
+}
+
+static void throughput(uint32_t baud)
+{
+    const uint16_t frames = 1000;
+    uint32_t due = 0;
+
+    reset("throughput");
+    for (uint16_t frame = 0; frame < frames; frame++)
+    {
+        // bytes arriving over the frame, 10 bits each
+        due += baud;
+        sim_receive(due / 10000);
+        due %= 10000;
+
+        host.free = HOST_FRAME_BYTES;
+        rx_dma_drain(0);
+    }
+
+    printf("%8lu  %8.1f  %9.1f  %8u  %5u\n", (unsigned long) baud,
+        sim.received / (double) frames, host.total / (double) frames,
+        host.overruns, port_stats[0].rx_high_water);
+}
+
+int main(void)
+{
+    test_in_order();
+    test_ring_end();
+    test_lapped();
+    test_block_end_race();
+    test_partial_writes();
+    test_count_wrap();
+
+    if (failures)
+    {
+        printf("rx_dma: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("rx_dma: all checks passed\n");
+
+    printf("\n%u-byte ring, drained every 1ms frame, host taking up to %u bytes a frame\n",
+        SIZE, HOST_FRAME_BYTES);
+    printf("    baud  in (B/ms)  out (B/ms)  overruns  ring hw\n");
+
+    static const uint32_t bauds[] =
+    {
+        115200, 230400, 460800, 921600, 1000000, 1200000, 1500000, 2000000
+    };
+    for (uint8_t i = 0; i < sizeof bauds / sizeof *bauds; i++) throughput(bauds[i]);
+
+    return 0;
+}
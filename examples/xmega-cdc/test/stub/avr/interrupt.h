@@ -0,0 +1,14 @@
+#ifndef ___n_stub_avr_interrupt_h__
+#define ___n_stub_avr_interrupt_h__
+
+// handlers become plain functions, which the test calls when the
+// simulated hardware would raise them
+#define ISR(vector)     void vector(void)
+
+#define DMA_CH0_vect    dma_ch0_isr
+#define DMA_CH1_vect    dma_ch1_isr
+#define DMA_CH2_vect    dma_ch2_isr
+#define DMA_CH3_vect    dma_ch3_isr
+#define TCD1_OVF_vect   tcd1_ovf_isr
+
+#endif /* ___n_stub_avr_interrupt_h__ */
@@ -0,0 +1,80 @@
+#ifndef ___n_stub_avr_io_h__
+#define ___n_stub_avr_io_h__
+
+#include <stdint.h>
+
+// Just enough of the XMEGA register file for rx_dma.c on the host.  A
+// DMA channel's CTRLB and TRFCNT are where the DMA controller and the
+// code race each other, so every access to them goes through
+// dma_sim_access() first (see rx_dma_test.c), which brings them up to
+// date with the simulated channel and can move the channel on at a
+// chosen point.
+
+typedef struct
+{
+    volatile uint8_t    DATA;
+} USART_t;
+
+typedef struct
+{
+    volatile uint8_t    CTRLA;
+    volatile uint16_t   CTRLB_[1];
+    volatile uint8_t    ADDRCTRL;
+    volatile uint8_t    TRIGSRC;
+    volatile uint16_t   TRFCNT_[1];
+    volatile uint8_t    REPCNT;
+    volatile uint8_t    SRCADDR0, SRCADDR1, SRCADDR2;
+    volatile uint8_t    DESTADDR0, DESTADDR1, DESTADDR2;
+} DMA_CH_t;
+
+typedef struct
+{
+    volatile uint8_t    CTRL;
+    DMA_CH_t            CH0, CH1, CH2, CH3;
+} DMA_t;
+
+typedef struct
+{
+    volatile uint8_t    CTRLA;
+    volatile uint8_t    INTCTRLA;
+    volatile uint16_t   CNT;
+    volatile uint16_t   PER;
+} TC_t;
+
+extern DMA_t DMA;
+extern TC_t TCD1, TCE0;
+
+int dma_sim_access(void);
+
+#define CTRLB   CTRLB_[dma_sim_access()]
+#define TRFCNT  TRFCNT_[dma_sim_access()]
+
+#define DMA_ENABLE_bm               0x80
+
+#define DMA_CH_ENABLE_bm            0x80
+#define DMA_CH_RESET_bm             0x40
+#define DMA_CH_REPEAT_bm            0x20
+#define DMA_CH_SINGLE_bm            0x04
+#define DMA_CH_BURSTLEN_1BYTE_gc    0x00
+
+#define DMA_CH_ERRIF_bm             0x20
+#define DMA_CH_TRNIF_bm             0x10
+#define DMA_CH_TRNINTLVL_HI_gc      0x03
+
+#define DMA_CH_SRCRELOAD_NONE_gc    0x00
+#define DMA_CH_SRCDIR_FIXED_gc      0x00
+#define DMA_CH_DESTRELOAD_BLOCK_gc  0x04
+#define DMA_CH_DESTDIR_INC_gc       0x01
+
+#define DMA_CH_TRIGSRC_USARTC0_RXC_gc   0x4B
+#define DMA_CH_TRIGSRC_USARTC1_RXC_gc   0x4E
+#define DMA_CH_TRIGSRC_USARTD0_RXC_gc   0x6B
+#define DMA_CH_TRIGSRC_USARTE0_RXC_gc   0x8B
+
+#define TC1_CLKSEL_gm               0x0F
+#define TC_CLKSEL_OFF_gc            0x00
+#define TC_CLKSEL_DIV1_gc           0x01
+#define TC_OVFINTLVL_OFF_gc         0x00
+#define TC_OVFINTLVL_LO_gc          0x01
+
+#endif /* ___n_stub_avr_io_h__ */
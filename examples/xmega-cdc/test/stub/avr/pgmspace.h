@@ -0,0 +1,7 @@
+#ifndef ___n_stub_avr_pgmspace_h__
+#define ___n_stub_avr_pgmspace_h__
+
+#define PROGMEM
+#define pgm_read_byte(p)    (*(const uint8_t *) (p))
+
+#endif /* ___n_stub_avr_pgmspace_h__ */
@@ -0,0 +1,23 @@
+#ifndef ___n_stub_udi_cdc_h__
+#define ___n_stub_udi_cdc_h__
+
+#include <stdint.h>
+
+// the settings rx_dma.c takes from conf/conf_usb.h, for one port
+#define UDI_CDC_PORT_NB         1
+#ifndef CDC_RX_DMA_SIZE
+#define CDC_RX_DMA_SIZE         128
+#endif
+#define CDC_LATENCY_TICK_US     250
+#ifndef F_CPU
+#define F_CPU                   24000000UL
+#endif
+
+typedef uint16_t iram_size_t;
+
+// UDI CDC's side, played by the test
+void udi_cdc_multi_signal_overrun(uint8_t port);
+iram_size_t udi_cdc_multi_get_free_tx_buffer(uint8_t port);
+iram_size_t udi_cdc_multi_write_buf(uint8_t port, const void *buf, iram_size_t size);
+
+#endif /* ___n_stub_udi_cdc_h__ */
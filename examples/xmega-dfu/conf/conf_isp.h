@@ -65,6 +65,27 @@
 #    define ISP_SMALL_MEMORY_SIZE
 #  endif
 
+// Pages of flash data buffered in RAM, so they can be programmed while
+// the host sends the next block (see isp.c).  0 programs each block
+// before acknowledging it, which is smaller: the 4KB boot sections of
+// the 64KB parts have no room to spare.
+#  if (FLASH_SIZE>0x10000)
+#    define ISP_FLASH_PIPELINE_PAGES   8
+#  else
+#    define ISP_FLASH_PIPELINE_PAGES   0
+#  endif
+
+// Whether flash writes read each page back first, to skip pages that
+// already hold the data and only erase ones it leaves blank (see
+// isp.c).  Unlike the pipeline this needs no RAM, only code; "size64"
+// in shake.hs checks that the 64KB parts' 4KB boot sections still fit.
+#  ifndef ISP_FLASH_SKIP_UNCHANGED
+#    define ISP_FLASH_SKIP_UNCHANGED   1
+#  endif
+
+// Programs pending flash pages; called from the main loop
+void isp_flash_poll(void);
+
 #endif
 
 #endif // _CONF_ISP_H_
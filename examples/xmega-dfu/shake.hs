@@ -2,43 +2,73 @@
 module Main where
 
 import Control.Monad
+import Data.AVR.ELF (Section(..), encodeIHex, readELF)
+import Data.Bits
+import qualified Data.ByteString as BS
 import Data.List
+import Data.Time.Clock
+import Data.Word
 import Development.Shake
 import Development.Shake.AVR
 import Development.Shake.FilePath
+import Text.Printf
 
 srcDir          = "src"
 asfDir          = "asf"
 asfRemoteURL    = "https://anonymous@spaces.atmel.com/git/asf"
 buildRoot       = "build"
 
-localBuildDir   = buildRoot </> "local"
-asfBuildDir     = buildRoot </> "asf"
-
 elfFile         = "dfu.elf"
 mapFile         = "dfu.map"
 
 device          = "atxmega128a4u"
 
+-- also built for a 64KB part, only to check that it fits that part's
+-- 4KB boot section ("size64"; see bootReport)
+device64        = "atxmega64a4u"
+elfFile64       = "dfu64.elf"
+mapFile64       = "dfu64.map"
+
+-- byte address and size of each part's boot section; nvm_asm's SPM
+-- code (.BOOT) goes in its last 0x44 bytes
+bootSection "atxmega128a4u" = (0x20000, 0x2000)
+bootSection "atxmega64a4u"  = (0x10000, 0x1000)
+bootSection dev             = error ("no boot section known for " ++ dev)
+
+buildDir dev    = buildRoot </> dev
+
 avrdudeFlags    = ["-c", "dragon_pdi"]
 
-commonFlags     = ["-pipe", "-mmcu=" ++ device] ++ optFlags
+-- "upload-bench" times dfu-programmer uploads of two images of
+-- pseudo-random data the size of benchBytes: onto erased flash, over
+-- the other image (every page erased and rewritten), and over itself
+-- (every page skipped).  The ms per page of the first two, compared
+-- with the datasheet's page write and erase+write times, shows how
+-- much of the upload is spent waiting on anything but the NVM.
+benchImages     = [buildRoot </> "bench-a.hex", buildRoot </> "bench-b.hex"]
+benchBytes      = 0x10000
+pageSize        = 256 -- FLASH_PAGE_SIZE
+
+commonFlags dev = ["-pipe", "-mmcu=" ++ dev] ++ optFlags
 optFlags        = ["-Os", "-ffunction-sections", "-fdata-sections"]
 
 cppFlags        = ["-Iconf", "-Isrc"] ++ asfDefines ++ map (("-I" ++) . (asfDir </>)) asfIncludes
 
-cFlags = commonFlags ++ cppFlags
+cFlags dev = commonFlags dev ++ cppFlags
     ++ ["-Wall", "-Werror", "-mrelax", "-std=gnu99"]
 
-asFlags = commonFlags ++ cppFlags
+asFlags dev = commonFlags dev ++ cppFlags
     ++ ["-x", "assembler-with-cpp", "-mrelax", "-D__ASSEMBLY__"]
     ++ map (("-Wa,-I" ++) . (asfDir </>)) asfIncludes
 
-ldFlags = commonFlags
-    ++ ["-Wl,--section-start=.text=0x20000"]
-    ++ ["-Wl,--section-start=.BOOT=0x21fbc"]
+ldFlags dev mapf = commonFlags dev
+    ++ ["-Wl,--section-start=.text=" ++ hex start]
+    ++ ["-Wl,--section-start=.BOOT=" ++ hex (start + size - 0x44)]
     ++ ["-Wl,--relax", "-Wl,--gc-sections"]
-    ++ ["-Wl,-Map=" ++ mapFile ++ ",--cref"]
+    ++ ["-Wl,-Map=" ++ mapf ++ ",--cref"]
+    where
+        (start, size) = bootSection dev
+        hex = printf "0x%x" :: Integer -> String
 
 asfDefines =
     [ "-DBOARD=USER_BOARD"
@@ -77,8 +107,8 @@ asfSources =
 
 -- defines rules to compile from a source dir to a build dir, mirroring
 -- the directory layout, appending '.o' to all source names, and
--- invoking known compilers as needed.
-compileRules fromDir toDir = 
+-- invoking known compilers as needed, for the given part.
+compileRules dev fromDir toDir = 
     toDir ++ "//*.o" *> \out -> do
         src <- case stripPrefix toDir (dropExtension out) of
             Just ('/':rest) -> return (fromDir </> rest)
@@ -87,17 +117,38 @@ compileRules fromDir toDir =
                 "which does not start with", show toDir]
         
         case takeExtension src of
-            ".c" -> avr_gcc cFlags src out
-            ".s" -> avr_gcc asFlags src out
+            ".c" -> avr_gcc (cFlags dev) src out
+            ".s" -> avr_gcc (asFlags dev) src out
             _   -> fail ("don't know how to compile this source: " ++ show src)
 
 main = shakeArgs shakeOptions $ do
     want ["size"]
     
-    "size"      ~> avr_size elfFile
-    "clean"     ~> removeFilesAfter "." [elfFile, mapFile, buildRoot]
+    "size"      ~> do avr_size elfFile;   bootReport device elfFile
+    "size64"    ~> do avr_size elfFile64; bootReport device64 elfFile64
+    "clean"     ~> removeFilesAfter "." [elfFile, mapFile, elfFile64, mapFile64, buildRoot]
     "veryclean" ~> do need ["clean"]; removeFilesAfter "." [asfDir]
     "flash"     ~> avrdude device avrdudeFlags (w Boot elfFile)
+    
+    benchImages &*> \outs -> forM_ (zip [1 ..] outs) $ \(seed, out) ->
+        writeFileChanged out (encodeIHex [(0, BS.pack (take benchBytes (noise seed)))])
+    
+    "upload-bench" ~> do
+        need benchImages
+        let [a, b] = benchImages
+            dfu args = command_ [] "dfu-programmer" (device : args)
+            upload what img = do
+                start <- liftIO getCurrentTime
+                dfu ["flash", "--force", img]
+                end <- liftIO getCurrentTime
+                let t = realToFrac (diffUTCTime end start) :: Double
+                putNormal $ printf "%-12s %6.2fs  %6.1f KB/s  %5.2f ms/page"
+                    what t (fromIntegral benchBytes / 1024 / t)
+                    (1000 * t / fromIntegral (benchBytes `div` pageSize))
+        dfu ["erase"]
+        upload "erased:" a
+        upload "rewritten:" b
+        upload "unchanged:" b
             
     "fuses"     ~> do
         avrdude device avrdudeFlags $ sequence_
@@ -109,12 +160,42 @@ main = shakeArgs shakeOptions $ do
         exists <- doesDirectoryExist out
         when (not exists) $ command_ [] "git" ["clone", asfRemoteURL, out]
     
-    [elfFile, mapFile] &*> \_ -> do
-        need [asfDir]
-        localSources <- getDirectoryFiles srcDir ["//*.c"]
-        let localObjs = [localBuildDir </> src <.> "o" | src <- localSources]
-            asfObjs   = [asfBuildDir   </> src <.> "o" | src <- asfSources]
-        avr_ld' "avr-gcc" ldFlags (localObjs ++ asfObjs) elfFile
-    
-    compileRules asfDir asfBuildDir
-    compileRules srcDir localBuildDir
+    forM_ [(device, elfFile, mapFile), (device64, elfFile64, mapFile64)] $ \(dev, elf, mapf) -> do
+        let localBuildDir   = buildDir dev </> "local"
+            asfBuildDir     = buildDir dev </> "asf"
+        
+        [elf, mapf] &*> \_ -> do
+            need [asfDir]
+            localSources <- getDirectoryFiles srcDir ["//*.c"]
+            let localObjs = [localBuildDir </> src <.> "o" | src <- localSources]
+                asfObjs   = [asfBuildDir   </> src <.> "o" | src <- asfSources]
+            avr_ld' "avr-gcc" (ldFlags dev mapf) (localObjs ++ asfObjs) elf
+        
+        compileRules dev asfDir asfBuildDir
+        compileRules dev srcDir localBuildDir
+
+-- prints how much of the part's boot section (less .BOOT) the code and
+-- initialised data take, and fails if they don't fit
+bootReport dev elf = do
+    need [elf]
+    sections <- liftIO (readELF elf)
+    let (start, size) = bootSection dev
+        room = size - 0x44
+        used = sum [ toInteger (BS.length (sectionData s))
+                   | s <- sections
+                   , sectionName s /= ".BOOT"
+                   , sectionAddr s >= start, sectionAddr s < start + size
+                   ]
+    putNormal $ printf "%s: %d of %d boot section bytes used, %d free"
+        elf used room (room - used)
+    when (used > room) $ fail (elf ++ " doesn't fit the boot section of " ++ dev)
+
+-- xorshift32, a byte per step
+noise :: Int -> [Word8]
+noise seed = map fromIntegral (tail (iterate step (fromIntegral seed :: Word32)))
+    where
+        step x0 = x3
+            where
+                x1 = x0 `xor` (x0 `shiftL` 13)
+                x2 = x1 `xor` (x1 `shiftR` 17)
+                x3 = x2 `xor` (x2 `shiftL` 5)
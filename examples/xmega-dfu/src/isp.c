@@ -45,6 +45,7 @@
 #include "nvm.h"
 #include "isp.h"
 #include "string.h"
+#include <avr/pgmspace.h>
 
 
 #ifdef __GNUC__
@@ -88,6 +89,144 @@ static isp_mem_bootloader_t mem_bootloader = {
 };
 //@}
 
+#if ISP_FLASH_SKIP_UNCHANGED
+/**
+ * \brief  Compare (part of) one flash page with new data
+ *
+ * The application section can't be read while the NVM controller is
+ * erasing or writing it (reads return garbage until it's done), and the
+ * previous page's erase or write may still be running, so this waits
+ * for the NVM controller first.
+ *
+ * \param dst    Pointer to flash destination.
+ * \param data   Pointer to source data.
+ * \param n      Number of bytes, all within the page.
+ * \param blank  Set to whether the data is all 0xFF.
+ *
+ * \return Whether the page already holds the data.
+ */
+static bool flash_page_compare(isp_addr_t dst, const uint8_t *data,
+		uint16_t n, bool *blank)
+{
+	bool same = true;
+	uint16_t i;
+
+	*blank = true;
+	nvm_wait_until_ready();
+	for (i = 0; i < n; i++) {
+		if (data[i] != pgm_read_byte_far(dst + i)) {
+			same = false;
+		}
+		if (data[i] != 0xFF) {
+			*blank = false;
+		}
+	}
+	return same;
+}
+#endif
+
+/**
+ * \brief  Program (part of) one flash page, unless it already holds the data
+ *
+ * With ISP_FLASH_SKIP_UNCHANGED; otherwise the page is always programmed.
+ * A page the data leaves blank is only erased.  Writes to pages that
+ * are already blank skip the erase in nvm_flash_erase_and_write_buffer.
+ * This doesn't wait for the erase or write it starts: the next NVM
+ * access waits for that instead, so USB keeps being serviced in the
+ * meantime.
+ *
+ * \param dst    Pointer to flash destination.
+ * \param data   Pointer to source data.
+ * \param n      Number of bytes, all within the page.
+ */
+static void flash_write_page(isp_addr_t dst, const uint8_t *data, uint16_t n)
+{
+#if ISP_FLASH_SKIP_UNCHANGED
+	bool blank;
+
+	if (flash_page_compare(dst, data, n, &blank)) {
+		// nothing to do
+	} else if (blank && n == FLASH_PAGE_SIZE) {
+		nvm_flash_erase_app_page(dst);
+	} else {
+		nvm_flash_erase_and_write_buffer(dst, data, n, true);
+	}
+#else
+	nvm_flash_erase_and_write_buffer(dst, data, n, true);
+#endif
+}
+
+#if ISP_FLASH_PIPELINE_PAGES
+/**
+ * \name Flash write pipeline
+ *
+ * A block from the host is copied here and acknowledged straight away,
+ * and its pages are programmed one at a time by isp_flash_poll (from
+ * the main loop) while the next block is on its way.  Only one page
+ * can be programmed at a time, so the NVM controller's page buffer is
+ * the other half of the pipeline.  Anything else that touches NVM
+ * finishes the pending pages first.
+ */
+//@{
+
+static struct {
+	uint8_t    data[ISP_FLASH_PIPELINE_PAGES * FLASH_PAGE_SIZE];
+	isp_addr_t dst;
+	uint16_t   pos;
+	uint16_t   len;
+} flash_pending;
+
+/**
+ * \brief  Start programming the next pending page
+ *
+ * \param wait   Whether to wait for the NVM controller if it's busy,
+ *               rather than doing nothing.
+ */
+static void flash_pending_step(bool wait)
+{
+	isp_addr_t dst = flash_pending.dst + flash_pending.pos;
+	uint16_t n = FLASH_PAGE_SIZE - (dst % FLASH_PAGE_SIZE);
+
+	if (flash_pending.pos == flash_pending.len) {
+		return;
+	}
+	if (!wait && (NVM.STATUS & NVM_NVMBUSY_bm)) {
+		return;
+	}
+
+	if (n > flash_pending.len - flash_pending.pos) {
+		n = flash_pending.len - flash_pending.pos;
+	}
+	flash_write_page(dst, flash_pending.data + flash_pending.pos, n);
+	flash_pending.pos += n;
+}
+
+static void flash_pending_flush(void)
+{
+	while (flash_pending.pos != flash_pending.len) {
+		flash_pending_step(true);
+	}
+}
+
+void isp_flash_poll(void)
+{
+	// the USB interrupt may want the NVM controller too
+	irqflags_t flags = cpu_irq_save();
+	flash_pending_step(false);
+	cpu_irq_restore(flags);
+}
+
+//@}
+#else
+static inline void flash_pending_flush(void)
+{
+}
+
+void isp_flash_poll(void)
+{
+}
+#endif
+
 /**
  * \brief  Copy a flash memory section to a RAM buffer
  *
@@ -97,19 +236,51 @@ static isp_mem_bootloader_t mem_bootloader = {
  */
 static void mem_flash_read(void *dst, isp_addr_t src, uint16_t nbytes)
 {
+	flash_pending_flush();
+	nvm_wait_until_ready();
 	nvm_flash_read_buffer(src, dst, nbytes);
 }
 
 /**
  * \brief  Copy a RAM buffer to a flash memory section
  *
+ * Works a page at a time (see flash_write_page), and returns as soon
+ * as the data is in the pipeline if there is one, so the host can send
+ * the next block while this one is programmed.
+ *
  * \param dst    Pointer to flash destination.
  * \param src    Pointer to source data.
  * \param nbytes Number of bytes to transfer.
  */
 static void mem_flash_write(isp_addr_t dst, const void *src, uint16_t nbytes)
 {
-	nvm_flash_erase_and_write_buffer(dst, src, nbytes, true);
+	const uint8_t *data = src;
+
+	flash_pending_flush();
+
+#if ISP_FLASH_PIPELINE_PAGES
+	if (nbytes <= sizeof(flash_pending.data)) {
+		memcpy(flash_pending.data, data, nbytes);
+		flash_pending.dst = dst;
+		flash_pending.pos = 0;
+		flash_pending.len = nbytes;
+		flash_pending_step(false);
+		return;
+	}
+#endif
+
+	while (nbytes) {
+		uint16_t n = FLASH_PAGE_SIZE - (dst % FLASH_PAGE_SIZE);
+
+		if (n > nbytes) {
+			n = nbytes;
+		}
+		flash_write_page(dst, data, n);
+
+		dst += n;
+		data += n;
+		nbytes -= n;
+	}
 }
 
 /**
@@ -121,6 +292,7 @@ static void mem_flash_write(isp_addr_t dst, const void *src, uint16_t nbytes)
  */
 static void mem_eeprom_read(void *dst, isp_addr_t src, uint16_t nbytes)
 {
+	flash_pending_flush();
 	nvm_eeprom_read_buffer( src, dst, nbytes );
 }
 
@@ -133,16 +305,23 @@ static void mem_eeprom_read(void *dst, isp_addr_t src, uint16_t nbytes)
  */
 static void mem_eeprom_write(isp_addr_t dst, const void *src, uint16_t nbytes)
 {
-#if (FLASH_SIZE==0x10000)
-	// Optimize CODE space (150B), but decrease the speed
-   	// 24s to program 2KB instead of 1s
-	while (nbytes--) {
-		nvm_eeprom_write_byte(dst++, *(uint8_t*)src);
-		src = (uint8_t*)src + 1;
+	flash_pending_flush();
+
+	// A page at a time, but built from the same small driver calls
+	// nvm_eeprom_write_byte uses rather than with
+	// nvm_eeprom_erase_and_write_buffer, which doesn't fit in the 4KB
+	// boot section of the 64KB parts.  An atomic page write only erases
+	// and writes the bytes loaded into the page buffer, so partial pages
+	// need no read-back.
+	while (nbytes) {
+		nvm_eeprom_flush_buffer();
+		do {
+			// (only the offset within the page matters here)
+			nvm_eeprom_load_byte_to_buffer(dst++, *(uint8_t*)src);
+			src = (uint8_t*)src + 1;
+		} while (--nbytes && (dst % EEPROM_PAGE_SIZE));
+		nvm_eeprom_atomic_write_page((dst - 1) / EEPROM_PAGE_SIZE);
 	}
-#else
-	nvm_eeprom_erase_and_write_buffer(dst, src, nbytes);
-#endif
 }
 
 
@@ -253,6 +432,8 @@ bool isp_is_security(void)
 
 bool isp_erase_chip(void)
 {
+	flash_pending_flush();
+	nvm_wait_until_ready();
 	nvm_flash_erase_app();
 	nvm_eeprom_erase_all();
 	return true;
@@ -262,6 +443,9 @@ bool isp_erase_chip(void)
 void isp_start_appli(void)
 {
 	cpu_irq_disable();
+	// don't reset in the middle of programming a page
+	flash_pending_flush();
+	nvm_wait_until_ready();
 	// generate soft reset for Xmega
 	start_app_key=0x55AA;
 	ccp_write_io((uint8_t *)&RST.CTRL, RST.CTRL | RST_SWRST_bm);
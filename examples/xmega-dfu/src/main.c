@@ -67,7 +67,7 @@ static void start_boot(void)
     udc_start();
     udc_attach();
     
-    while (true);
+    while (true) isp_flash_poll();
 }
 
 int main(void)
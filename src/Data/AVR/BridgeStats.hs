@@ -0,0 +1,128 @@
+-- |The per-port counters kept by the xmega-cdc example's USB-serial
+-- bridge (examples/xmega-cdc/src/stats.h), read with a vendor control
+-- request:
+--
+-- >    bmRequestType 0xC0, bRequest 1, wValue 1 to clear after reading
+--
+-- The reply is a header then one fixed-size entry per port:
+--
+-- >    header:  u8 version, u8 port count, u8 entry size, u8 F_CPU (MHz)
+-- >    entry:   u32 rx bytes, u32 tx bytes, u16 overruns,
+-- >             u16 framing errors, u16 longest ISR (cycles),
+-- >             u8 RX high water, u8 TX high water
+--
+-- All integers are little-endian.  Entries may grow; anything past the
+-- fields above is ignored.
+--
+-- The same firmware takes a second vendor request, setting a port's
+-- low-latency mode (examples/xmega-cdc/src/rx_dma.h):
+--
+-- >    bmRequestType 0x40, bRequest 2, wIndex port,
+-- >    wValue idle limit (ticks) | threshold (bytes) << 8
+module Data.AVR.BridgeStats
+    ( BridgeStats(..)
+    , PortStats(..)
+    , readBridgeStats
+    , setBridgeLatency
+    , decodeBridgeStats
+    , formatBridgeStats
+    ) where
+
+import Data.Bits
+import qualified Data.ByteString as BS
+import qualified Data.Vector as V
+import Data.Word
+import System.USB
+import Text.Printf
+
+data BridgeStats = BridgeStats
+    { bridgeClockMHz    :: !Int
+    , bridgePorts       :: [PortStats]
+    }
+
+data PortStats = PortStats
+    { portRxBytes       :: !Word32  -- ^ serial to USB
+    , portTxBytes       :: !Word32  -- ^ USB to serial
+    , portOverruns      :: !Word16
+    , portFramingErrors :: !Word16
+    , portISRMax        :: !Word16  -- ^ CPU cycles
+    , portRxHighWater   :: !Word8
+    , portTxHighWater   :: !Word8
+    }
+
+statsRequest    = 0x01
+latencyRequest  = 0x02
+statsVersion    = 1
+headerSize      = 4
+entrySize       = 16
+
+-- |Read the counters from the first attached device with the given
+-- vendor and product IDs, telling it to zero them afterwards if
+-- 'clear' is set.
+readBridgeStats :: Word16 -> Word16 -> Bool -> IO BridgeStats
+readBridgeStats vid pid clear = do
+    (reply, _) <- withBridge vid pid $ \h ->
+        readControl h (vendorRequest statsRequest (if clear then 1 else 0) 0)
+            (headerSize + 4 * entrySize) 1000
+    either fail return (decodeBridgeStats reply)
+
+-- |Put a port in low-latency mode: received bytes are sent on once the
+-- line has been idle for 'idle' ticks (of the firmware's
+-- CDC_LATENCY_TICK_US) or 'threshold' bytes are waiting (0 for no
+-- threshold).  An 'idle' of 0 turns the mode off.
+setBridgeLatency :: Word16 -> Word16 -> Int -> Word8 -> Word8 -> IO ()
+setBridgeLatency vid pid port idle threshold =
+    withBridge vid pid $ \h ->
+        control h (vendorRequest latencyRequest value (fromIntegral port)) 1000
+    where value = fromIntegral threshold `shiftL` 8 .|. fromIntegral idle
+
+-- the first attached device with the given vendor and product IDs
+withBridge :: Word16 -> Word16 -> (DeviceHandle -> IO a) -> IO a
+withBridge vid pid action = do
+    ctx     <- newCtx
+    devs    <- fmap V.toList (getDevices ctx)
+    descs   <- mapM getDeviceDesc devs
+    case [dev | (dev, desc) <- zip devs descs, deviceVendorId desc == vid, deviceProductId desc == pid] of
+        dev : _ -> withDeviceHandle dev action
+        []      -> fail (printf "no USB device %04x:%04x attached" vid pid)
+
+vendorRequest request value index = ControlSetup
+    { controlSetupRequestType   = Vendor
+    , controlSetupRecipient     = ToDevice
+    , controlSetupRequest       = request
+    , controlSetupValue         = value
+    , controlSetupIndex         = index
+    }
+
+decodeBridgeStats :: BS.ByteString -> Either String BridgeStats
+decodeBridgeStats bytes
+    | BS.length bytes < headerSize
+        = Left "bridge stats: short reply"
+    | version /= statsVersion
+        = Left ("bridge stats: unknown version " ++ show version)
+    | size < entrySize || BS.length bytes < headerSize + ports * size
+        = Left "bridge stats: reply doesn't hold the entries its header describes"
+    | otherwise
+        = Right (BridgeStats mhz (map entry [0 .. ports - 1]))
+    where
+        byte i  = fromIntegral (BS.index bytes i) :: Int
+        version = byte 0
+        ports   = byte 1
+        size    = byte 2
+        mhz     = byte 3
+
+        entry n = PortStats (le 0 4) (le 4 4) (le 8 2) (le 10 2) (le 12 2) (le 14 1) (le 15 1)
+            where
+                base = headerSize + n * size
+                le :: (Integral a, Bits a) => Int -> Int -> a
+                le off len = foldr (\i acc -> acc `shiftL` 8 .|. fromIntegral (byte (base + off + i))) 0 [0 .. len - 1]
+
+formatBridgeStats :: BridgeStats -> String
+formatBridgeStats stats = unlines $
+    "port    rx bytes    tx bytes  overruns  framing  ISR max (us)  RX hw  TX hw" :
+    [ printf "%4d  %10d  %10d  %8d  %7d  %12.1f  %5d  %5d" n
+        (portRxBytes p) (portTxBytes p) (portOverruns p) (portFramingErrors p)
+        (fromIntegral (portISRMax p) / mhz) (portRxHighWater p) (portTxHighWater p)
+    | (n, p) <- zip [0 :: Int ..] (bridgePorts stats)
+    ]
+    where mhz = fromIntegral (max 1 (bridgeClockMHz stats)) :: Double
@@ -0,0 +1,231 @@
+{-# LANGUAGE CPP #-}
+-- |Timestamped captures of one or more serial streams.
+--
+-- A capture file is a header naming the ports, then one record per
+-- chunk read from a port, exactly as the read returned it:
+--
+-- >    header:  "AVRCAP01", u16 port count, (u16 length, name) per port
+-- >    record:  u8 port, u64 monotonic time (ns), u32 length, data
+-- >    index:   u32 count, (u64 record offset, u64 time) per record,
+-- >             u64 index offset, "AVRCIDX1"
+--
+-- All integers are little-endian.  The index is only written when a
+-- capture finishes cleanly; without it, readers fall back to scanning.
+module Data.AVR.Capture
+    ( Chunk(..)
+    , Capture(..)
+    , configurePort
+    , rawAttributes
+    , capture
+    , readCapture
+    , decodeCapture
+    , readCaptureRange
+    ) where
+
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import Data.Bits
+import qualified Data.ByteString as BS
+import qualified Data.ByteString.Builder as B
+import qualified Data.ByteString.Char8 as BS8
+import qualified Data.ByteString.Lazy as BL
+import Data.IORef
+import Data.Monoid
+import Data.Word
+import System.Clock
+import System.IO
+import System.Posix.IO
+import System.Posix.Terminal
+
+data Chunk = Chunk
+    { chunkPort     :: !Int
+    , chunkTime     :: !Word64
+    , chunkData     :: !BS.ByteString
+    }
+
+data Capture = Capture
+    { capturePorts  :: [FilePath]
+    , captureChunks :: [Chunk]
+    }
+
+headerMagic, indexMagic :: BS.ByteString
+headerMagic = BS8.pack "AVRCAP01"
+indexMagic  = BS8.pack "AVRCIDX1"
+
+-- |Put a serial port (or the pty end of a stand-in for one) in raw
+-- mode, 8N1, at the given baud rate.  This is what "stty raw -echo"
+-- does, but through termios directly, so it doesn't depend on which
+-- flavour of stty the host has.
+configurePort :: FilePath -> Integer -> IO ()
+configurePort dev baud = do
+    speed <- maybe (fail (dev ++ ": unsupported baud rate " ++ show baud)) return
+        (lookup baud baudRates)
+#if MIN_VERSION_unix(2,8,0)
+    fd <- openFd dev ReadWrite defaultFileFlags { noctty = True, nonBlock = True }
+#else
+    fd <- openFd dev ReadWrite Nothing defaultFileFlags { noctty = True, nonBlock = True }
+#endif
+    flip finally (closeFd fd) $ do
+        attrs <- getTerminalAttributes fd
+        let serial = foldl withMode (foldl withoutMode (rawAttributes attrs) [EnableParity, TwoStopBits])
+                [LocalMode, ReadEnable]
+        setTerminalAttributes fd
+            (withInputSpeed (withOutputSpeed (withBits serial 8) speed) speed) Immediately
+    where
+        baudRates =
+            [ (300, B300), (600, B600), (1200, B1200), (2400, B2400), (4800, B4800)
+            , (9600, B9600), (19200, B19200), (38400, B38400), (57600, B57600)
+            , (115200, B115200)
+#if MIN_VERSION_unix(2,8,0)
+            , (230400, B230400)
+#endif
+            ]
+
+-- |Terminal attributes with line editing, echo, signals, flow control
+-- and character translation all off, and reads returning as soon as
+-- there's a byte.
+rawAttributes :: TerminalAttributes -> TerminalAttributes
+rawAttributes attrs = flip withMinInput 1 . flip withTime 0 $ foldl withoutMode attrs
+    [ EnableEcho, ProcessInput, ExtendedFunctions, KeyboardInterrupts
+    , StartStopOutput, StartStopInput, MapCRtoLF, ProcessOutput
+    ]
+
+-- |Capture everything that arrives on the given (already configured)
+-- ports for the given number of seconds.  Each port gets its own reader
+-- thread; data is written in whatever chunks the reads return, so the
+-- cost is per read, not per byte.
+capture :: [FilePath] -> Double -> FilePath -> IO ()
+capture ports seconds out =
+    withBinaryFile out WriteMode $ \h -> do
+        B.hPutBuilder h (encodeHeader ports)
+        offset  <- newMVar (fromIntegral (BL.length (B.toLazyByteString (encodeHeader ports))))
+        index   <- newIORef []
+
+        let record port bytes =
+                -- a reader killed mid-write would leave the file and the
+                -- index out of step, so writes aren't interruptible.  The
+                -- time is taken inside too, so records (and the index,
+                -- which readCaptureRange searches) are in time order
+                modifyMVar_ offset $ \off -> uninterruptibleMask_ $ do
+                    t <- getTime Monotonic
+                    let time = fromInteger (toNanoSecs t)
+                    B.hPutBuilder h (encodeRecord port time bytes)
+                    modifyIORef index ((off, time) :)
+                    return $! off + 13 + fromIntegral (BS.length bytes)
+            reader (port, dev) = withBinaryFile dev ReadMode $ \src -> do
+                hSetBuffering src NoBuffering
+                forever $ do
+                    bytes <- BS.hGetSome src 4096
+                    if BS.null bytes
+                        then threadDelay 1000
+                        else record port bytes
+
+        done <- newEmptyMVar
+        readers <- forM (zip [0 ..] ports) $ \p ->
+            forkIO (reader p `finally` putMVar done ())
+        threadDelay (round (seconds * 1e6))
+        mapM_ killThread readers
+        replicateM_ (length readers) (takeMVar done)
+
+        off <- takeMVar offset
+        entries <- fmap reverse (readIORef index)
+        B.hPutBuilder h (encodeIndex off entries)
+
+encodeHeader :: [FilePath] -> B.Builder
+encodeHeader ports = B.byteString headerMagic
+    <> B.word16LE (fromIntegral (length ports))
+    <> mconcat
+        [ B.word16LE (fromIntegral (BS.length name)) <> B.byteString name
+        | name <- map BS8.pack ports
+        ]
+
+encodeRecord :: Int -> Word64 -> BS.ByteString -> B.Builder
+encodeRecord port time bytes = B.word8 (fromIntegral port)
+    <> B.word64LE time
+    <> B.word32LE (fromIntegral (BS.length bytes))
+    <> B.byteString bytes
+
+encodeIndex :: Word64 -> [(Word64, Word64)] -> B.Builder
+encodeIndex off entries = B.word32LE (fromIntegral (length entries))
+    <> mconcat [B.word64LE o <> B.word64LE t | (o, t) <- entries]
+    <> B.word64LE off
+    <> B.byteString indexMagic
+
+readCapture :: FilePath -> IO Capture
+readCapture path = do
+    bytes <- BS.readFile path
+    either (fail . ((path ++ ": ") ++)) return (decodeCapture bytes)
+
+-- |Decode a whole capture, whether or not it has an index.
+decodeCapture :: BS.ByteString -> Either String Capture
+decodeCapture bytes = do
+    (ports, start) <- decodeHeader bytes
+    let end = maybe (BS.length bytes) (fromIntegral . fst) (decodeIndex bytes)
+    return (Capture ports (decodeRecords (BS.take end bytes) start))
+
+-- |Read just the chunks with timestamps in [from, to), using the index
+-- to find them.  Captures without an index are scanned instead.
+readCaptureRange :: Word64 -> Word64 -> FilePath -> IO Capture
+readCaptureRange from to path = do
+    bytes <- BS.readFile path
+    case decodeHeader bytes of
+        Left err            -> fail (path ++ ": " ++ err)
+        Right (ports, start) -> return $ Capture ports $ case decodeIndex bytes of
+            Nothing             -> filter inRange (decodeRecords bytes start)
+            Just (end, entries) -> takeWhile inRange $ decodeRecords (BS.take (fromIntegral end) bytes)
+                $ case dropWhile ((< from) . snd) entries of
+                    (off, _) : _    -> fromIntegral off
+                    []              -> fromIntegral end
+    where
+        inRange c = from <= chunkTime c && chunkTime c < to
+
+decodeHeader :: BS.ByteString -> Either String ([FilePath], Int)
+decodeHeader bytes
+    | BS.take 8 bytes /= headerMagic    = Left "not a capture file"
+    | BS.length bytes < 10              = Left "truncated capture header"
+    | otherwise                         = go (u16 bytes 8) 10 []
+    where
+        go :: Int -> Int -> [FilePath] -> Either String ([FilePath], Int)
+        go 0 off names = Right (reverse names, off)
+        go n off names
+            | BS.length bytes < off + 2         = Left "truncated capture header"
+            | BS.length bytes < off + 2 + len   = Left "truncated capture header"
+            | otherwise = go (n - 1) (off + 2 + len) (BS8.unpack (BS.take len (BS.drop (off + 2) bytes)) : names)
+            where len = u16 bytes off
+
+decodeIndex :: BS.ByteString -> Maybe (Word64, [(Word64, Word64)])
+decodeIndex bytes = do
+    let n = BS.length bytes
+    guard (n >= 16 && BS.drop (n - 8) bytes == indexMagic)
+    let off = u64 bytes (n - 16)
+    guard (off + 4 + 16 <= fromIntegral n)
+    let count = fromIntegral (u32 bytes (fromIntegral off))
+        entryAt i = let p = fromIntegral off + 4 + 16 * i in (u64 bytes p, u64 bytes (p + 8))
+    guard (fromIntegral off + 4 + 16 * count + 16 == n)
+    return (off, map entryAt [0 .. count - 1])
+
+-- stops quietly at a truncated record, which is what a capture that
+-- was killed mid-write ends with
+decodeRecords :: BS.ByteString -> Int -> [Chunk]
+decodeRecords bytes off
+    | BS.length bytes < off + 13        = []
+    | BS.length bytes < off + 13 + len  = []
+    | otherwise = Chunk port time (BS.take len (BS.drop (off + 13) bytes))
+        : decodeRecords bytes (off + 13 + len)
+    where
+        port = fromIntegral (BS.index bytes off)
+        time = u64 bytes (off + 1)
+        len  = fromIntegral (u32 bytes (off + 9))
+
+u16 :: Num a => BS.ByteString -> Int -> a
+u16 bs i = fromIntegral (le bs i 2)
+
+u32 :: BS.ByteString -> Int -> Word32
+u32 bs i = fromIntegral (le bs i 4)
+
+u64 :: BS.ByteString -> Int -> Word64
+u64 bs i = le bs i 8
+
+le :: BS.ByteString -> Int -> Int -> Word64
+le bs i n = foldr (\k acc -> acc `shiftL` 8 .|. fromIntegral (BS.index bs (i + k))) 0 [0 .. n - 1]
@@ -0,0 +1,153 @@
+module Data.AVR.ELF
+    ( Section(..)
+    , readELF
+    , parseELF
+    , memoryImage
+    , encodeIHex
+    ) where
+
+import Data.Bits
+import qualified Data.ByteString as BS
+import Data.List
+import Data.Ord
+import Data.Word
+import System.Command.AVRDUDE (MemType(..))
+import Text.Printf
+
+-- |An allocated section with contents, placed at its load address.
+data Section = Section
+    { sectionName   :: String
+    , sectionAddr   :: Integer
+    , sectionData   :: BS.ByteString
+    }
+
+readELF :: FilePath -> IO [Section]
+readELF path = do
+    elf <- BS.readFile path
+    either (fail . ((path ++ ": ") ++)) return (parseELF elf)
+
+-- |Reads the loadable contents of a 32-bit little-endian ELF file
+-- (which is what avr-gcc and arm-none-eabi-gcc both produce).
+-- Load addresses are taken from the program headers where possible,
+-- so .data is placed after .text the way avr-objcopy places it.
+parseELF :: BS.ByteString -> Either String [Section]
+parseELF elf
+    | BS.length elf < 52                    = Left "file too short to be ELF"
+    | BS.take 4 elf /= BS.pack [0x7f, 0x45, 0x4c, 0x46]
+                                            = Left "not an ELF file"
+    | BS.index elf 4 /= 1                   = Left "not a 32-bit ELF file"
+    | BS.index elf 5 /= 1                   = Left "not a little-endian ELF file"
+    | BS.length elf < tableEnd              = Left "truncated ELF file"
+    | otherwise                             = Right
+        [ Section (sectionNameAt (u32 sh 0)) (loadAddr sh) (bytes (u32 sh 16) (u32 sh 20))
+        | sh <- sectionHeaders
+        , u32 sh 4 == shtProgBits
+        , testBit (u32 sh 8) shfAlloc
+        , u32 sh 20 > 0
+        ]
+    where
+        shtProgBits = 1
+        shfAlloc    = 1
+        ptLoad      = 1
+
+        phoff       = u32 elf 28
+        shoff       = u32 elf 32
+        phentsize   = u16 elf 42
+        phnum       = u16 elf 44
+        shentsize   = u16 elf 46
+        shnum       = u16 elf 48
+        shstrndx    = u16 elf 50
+        tableEnd    = fromInteger (max (phoff + phentsize * phnum) (shoff + shentsize * shnum))
+
+        bytes off len = BS.take (fromInteger len) (BS.drop (fromInteger off) elf)
+        table off size n = [bytes (off + size * i) size | i <- [0 .. n - 1]]
+
+        programHeaders  = table phoff phentsize phnum
+        sectionHeaders  = table shoff shentsize shnum
+
+        sectionNameAt i = case drop (fromInteger shstrndx) sectionHeaders of
+            strtab : _  -> map (toEnum . fromIntegral) . BS.unpack . BS.takeWhile (/= 0)
+                         $ BS.drop (fromInteger i) (bytes (u32 strtab 16) (u32 strtab 20))
+            []          -> ""
+
+        loadAddr sh = case segments of
+            ph : _  -> u32 ph 12 + off - u32 ph 4
+            []      -> u32 sh 12
+            where
+                off = u32 sh 16
+                segments =
+                    [ ph
+                    | ph <- programHeaders
+                    , u32 ph 0 == ptLoad
+                    , u32 ph 4 <= off
+                    , off < u32 ph 4 + u32 ph 16
+                    ]
+
+u8 :: BS.ByteString -> Int -> Integer
+u8 bs i = toInteger (BS.index bs i)
+
+u16 :: BS.ByteString -> Int -> Integer
+u16 bs i = u8 bs i .|. (u8 bs (i + 1) `shiftL` 8)
+
+u32 :: BS.ByteString -> Int -> Integer
+u32 bs i = u16 bs i .|. (u16 bs (i + 2) `shiftL` 16)
+
+-- avr-gcc places each memory in its own region of the ELF address space.
+-- Individual fuse bytes are picked out of the fuse region by index.
+memoryRegion :: MemType -> Maybe (Integer, Integer, Maybe Int)
+memoryRegion Flash          = Just (0x000000, 0x800000, Nothing)
+memoryRegion Application    = Just (0x000000, 0x800000, Nothing)
+memoryRegion EEPROM         = Just (0x810000, 0x820000, Nothing)
+memoryRegion Fuse           = Just (0x820000, 0x830000, Just 0)
+memoryRegion LFuse          = Just (0x820000, 0x830000, Just 0)
+memoryRegion HFuse          = Just (0x820000, 0x830000, Just 1)
+memoryRegion EFuse          = Just (0x820000, 0x830000, Just 2)
+memoryRegion (FuseN n)      = Just (0x820000, 0x830000, Just (fromInteger n))
+memoryRegion Lock           = Just (0x830000, 0x840000, Nothing)
+memoryRegion Signature      = Just (0x840000, 0x850000, Nothing)
+memoryRegion UserSig        = Just (0x850000, 0x860000, Nothing)
+memoryRegion _              = Nothing
+
+-- |Extract the contents of one memory from the sections of an ELF file,
+-- as (address, bytes) chunks relative to the start of that memory.
+-- Returns Nothing for memory types that have no region in the ELF file.
+memoryImage :: MemType -> [Section] -> Maybe [(Integer, BS.ByteString)]
+memoryImage mem sections = do
+    (lo, hi, byteSel) <- memoryRegion mem
+    let chunks =
+            [ (addr - lo, dat)
+            | Section _ addr dat <- sections
+            , lo <= addr, addr < hi
+            ]
+    return (maybe chunks (selectByte chunks) byteSel)
+    where
+        selectByte chunks i = take 1
+            [ (0, BS.singleton (BS.index dat off))
+            | (addr, dat) <- chunks
+            , let off = i - fromInteger addr
+            , 0 <= off, off < BS.length dat
+            ]
+
+-- |Render chunks as Intel HEX, in 16-byte records with extended linear
+-- address records wherever the upper 16 bits change.
+encodeIHex :: [(Integer, BS.ByteString)] -> String
+encodeIHex chunks = unlines (records 0 rows ++ [ihexRecord 1 0 []])
+    where
+        rows = concat [split addr (BS.unpack dat) | (addr, dat) <- sortBy (comparing fst) chunks]
+
+        split _ [] = []
+        split addr bytes = (addr, row) : split (addr + toInteger (length row)) rest
+            where
+                n = fromInteger (min 16 (0x10000 - (addr .&. 0xFFFF)))
+                (row, rest) = splitAt n bytes
+
+        records _ [] = []
+        records seg rs@((addr, row) : more)
+            | upper /= seg  = ihexRecord 4 0 [fromInteger (upper `shiftR` 8), fromInteger upper] : records upper rs
+            | otherwise     = ihexRecord 0 (addr .&. 0xFFFF) row : records seg more
+            where upper = addr `shiftR` 16
+
+ihexRecord :: Word8 -> Integer -> [Word8] -> String
+ihexRecord ty addr bytes = ':' : concatMap (printf "%02X") (body ++ [negate (sum body)])
+    where
+        body = fromIntegral (length bytes) : fromInteger (addr `shiftR` 8) : fromInteger addr : ty : bytes
@@ -0,0 +1,81 @@
+-- |Round-trip latency through a serial link that echoes everything it's
+-- sent: a USB-serial bridge port with its RX and TX tied together, say,
+-- or 'withLoopback''s stand-in for one.
+module Data.AVR.Latency
+    ( roundTrips
+    , withLoopback
+    , latencyReport
+    ) where
+
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import Data.AVR.Capture (rawAttributes)
+import qualified Data.ByteString as BS
+import Data.List
+import System.Clock
+import System.IO
+import System.Posix.IO
+import System.Posix.Terminal
+import System.Timeout
+import Text.Printf
+
+-- |'roundTrips dev size count' sends 'count' messages of 'size' bytes
+-- to an (already configured) port, one at a time, waiting for each to
+-- come all the way back before sending the next, and returns the time
+-- each took in seconds.  Each message is different, so a late echo of
+-- an earlier one can't be mistaken for the current one.
+roundTrips :: FilePath -> Int -> Int -> IO [Double]
+roundTrips dev size count =
+    withBinaryFile dev ReadWriteMode $ \h -> do
+        hSetBuffering h NoBuffering
+        forM [1 .. count] $ \n -> do
+            let msg = BS.pack [fromIntegral (n + i) | i <- [0 .. size - 1]]
+            start <- getTime Monotonic
+            BS.hPut h msg
+            echo <- timeout 1000000 (receive h size)
+            end <- getTime Monotonic
+            case echo of
+                Nothing -> fail (printf "%s: no echo within 1s (exchange %d)" dev n)
+                Just bytes | bytes /= msg
+                        -> fail (printf "%s: echo doesn't match what was sent (exchange %d)" dev n)
+                _       -> return (fromInteger (toNanoSecs end - toNanoSecs start) / 1e9)
+
+receive :: Handle -> Int -> IO BS.ByteString
+receive h = go []
+    where
+        go chunks 0 = return (BS.concat (reverse chunks))
+        go chunks n = do
+            bytes <- BS.hGetSome h n
+            go (bytes : chunks) (n - BS.length bytes)
+
+-- |Run an action with the name of a pseudo-terminal that echoes back
+-- everything written to it, straight away.  Benchmarking that gives a
+-- floor for 'roundTrips' with no device involved.
+withLoopback :: (FilePath -> IO a) -> IO a
+withLoopback action = do
+    (master, slave) <- openPseudoTerminal
+    name    <- getSlaveTerminalName master
+    attrs   <- getTerminalAttributes slave
+    setTerminalAttributes slave (rawAttributes attrs) Immediately
+
+    h <- fdToHandle master
+    hSetBuffering h NoBuffering
+    echo <- forkIO $ forever (BS.hGetSome h 4096 >>= BS.hPut h)
+
+    action name `finally` (killThread echo >> hClose h >> closeFd slave)
+
+latencyReport :: FilePath -> Int -> [Double] -> String
+latencyReport dev size times = unlines $
+    [ printf "%s: %d round trips of %d bytes" dev (length times) size
+    , printf "  min     %8.3f ms" (ms (head sorted))
+    , printf "  median  %8.3f ms" (ms (pct 50))
+    , printf "  90%%     %8.3f ms" (ms (pct 90))
+    , printf "  99%%     %8.3f ms" (ms (pct 99))
+    , printf "  max     %8.3f ms" (ms (last sorted))
+    , printf "  mean    %8.3f ms" (ms (sum times / fromIntegral (length times)))
+    ]
+    where
+        sorted  = sort times
+        ms      = (* 1000)
+        pct p   = sorted !! min (length sorted - 1) (p * length sorted `div` 100)
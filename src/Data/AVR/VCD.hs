@@ -0,0 +1,76 @@
+-- |Just enough of a Value Change Dump reader to get traces out of
+-- simulators: every variable's changes as (seconds, value) pairs.
+-- Unknown and high-impedance values are dropped.
+module Data.AVR.VCD
+    ( Signal(..)
+    , readVCD
+    , parseVCD
+    , findSignal
+    ) where
+
+import Data.Char
+import Data.List
+import qualified Data.Map as M
+
+data Signal = Signal
+    { signalName    :: String
+    , signalChanges :: [(Double, Integer)]
+    }
+
+readVCD :: FilePath -> IO [Signal]
+readVCD path = do
+    vcd <- readFile path
+    either (fail . ((path ++ ": ") ++)) return (parseVCD vcd)
+
+-- |Find a signal by name, ignoring scopes (which simulators don't
+-- always agree on anyway).
+findSignal :: String -> [Signal] -> Maybe Signal
+findSignal name = find ((name ==) . signalName)
+
+parseVCD :: String -> Either String [Signal]
+parseVCD = header 1e-9 M.empty . words
+    where
+        header scale vars ("$timescale" : rest) = case break (== "$end") rest of
+            (spec, _ : more)    -> case parseTimescale (concat spec) of
+                Just s              -> header s vars more
+                Nothing             -> Left ("bad timescale: " ++ unwords spec)
+            _                   -> Left "unterminated $timescale"
+        header scale vars ("$var" : _ : _ : ident : name : rest) =
+            header scale (M.insert ident name vars) (drop 1 (dropWhile (/= "$end") rest))
+        header scale vars ("$enddefinitions" : rest) =
+            Right (body scale vars (drop 1 (dropWhile (/= "$end") rest)))
+        header scale vars (('$' : _) : rest) =
+            header scale vars (drop 1 (dropWhile (/= "$end") rest))
+        header _ _ (tok : _) = Left ("unexpected token in header: " ++ tok)
+        header _ _ [] = Left "no $enddefinitions"
+
+        body scale vars toks =
+            [ Signal name (reverse (M.findWithDefault [] ident changes))
+            | (ident, name) <- M.toList vars
+            ]
+            where changes = values scale 0 M.empty toks
+
+        values scale t acc toks = case toks of
+            []                          -> acc
+            ('#' : time) : rest         -> values scale (scale * read time) acc rest
+            (c : bits) : ident : rest
+                | c `elem` "bB"         -> values scale t (change ident (binary bits)) rest
+                | c `elem` "rR"         -> values scale t acc rest
+            ('$' : _) : rest            -> values scale t acc rest
+            (c : ident) : rest
+                | c `elem` "01"         -> values scale t (change ident (Just (toInteger (digitToInt c)))) rest
+            _ : rest                    -> values scale t acc rest
+            where
+                change ident (Just v)   = M.insertWith (++) ident [(t, v)] acc
+                change _     Nothing    = acc
+
+        binary bits
+            | all (`elem` "01") bits    = Just (foldl' (\acc b -> 2 * acc + toInteger (digitToInt b)) 0 bits)
+            | otherwise                 = Nothing
+
+parseTimescale :: String -> Maybe Double
+parseTimescale spec = case span isDigit spec of
+    (digits@(_:_), unit)    -> fmap (read digits *) (lookup unit units)
+    _                       -> Nothing
+    where
+        units = [("s", 1), ("ms", 1e-3), ("us", 1e-6), ("ns", 1e-9), ("ps", 1e-12), ("fs", 1e-15)]
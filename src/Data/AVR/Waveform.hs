@@ -0,0 +1,119 @@
+-- |Timing and spectral statistics for PWM waveforms recovered from
+-- simulator traces (see "Data.AVR.VCD"): how regularly a duty-cycle
+-- register is updated, what the output pin's duty cycle looks like, and
+-- the power spectrum of the stream of duty-cycle values.
+module Data.AVR.Waveform
+    ( UpdateStats(..)
+    , updateStats
+    , resample
+    , dutyCycles
+    , histogram
+    , powerSpectrum
+    , cornerFrequency
+    ) where
+
+import Data.List
+import qualified Data.Map as M
+
+data UpdateStats = UpdateStats
+    { updateCount       :: Int
+    , updatePeriod      :: Double   -- ^ mean seconds between updates
+    , updateJitterRMS   :: Double
+    , updateJitterMax   :: Double
+    }
+
+-- |Update statistics for a register trace.  A VCD only records changes,
+-- so writes that repeat the previous value don't show up; intervals are
+-- counted as whole multiples of the shortest typical interval (the 5th
+-- percentile) and split evenly.  The first change (the value at reset)
+-- is ignored.
+updateStats :: [(Double, Integer)] -> Maybe UpdateStats
+updateStats changes
+    | length intervals < 2  = Nothing
+    | otherwise             = Just (UpdateStats (length frames) mean rms worst)
+    where
+        times       = map fst (drop 1 changes)
+        intervals   = filter (> 0) (zipWith (-) (drop 1 times) times)
+        base        = sort intervals !! (length intervals `div` 20)
+        frames      = concat
+            [ replicate k (iv / fromIntegral k)
+            | iv <- intervals
+            , let k = max 1 (round (iv / base))
+            ]
+        mean        = sum frames / fromIntegral (length frames)
+        devs        = [f - mean | f <- frames]
+        rms         = sqrt (sum (map (^ (2 :: Int)) devs) / fromIntegral (length devs))
+        worst       = maximum (map abs devs)
+
+-- |Sample-and-hold a register trace once per 'period', in the middle of
+-- each update period, starting from the first update after reset.
+resample :: Double -> [(Double, Integer)] -> [Integer]
+resample period changes = case drop 1 changes of
+    []                  -> []
+    cs@((t0, v0) : _)   -> go v0 cs (takeWhile (<= fst (last cs))
+                                [t0 + period * (fromIntegral k + 0.5) | k <- [0 :: Int ..]])
+    where
+        go _ _ [] = []
+        go v cs (t : ts) = v' : go v' future ts
+            where
+                (past, future) = span ((<= t) . fst) cs
+                v' = if null past then v else snd (last past)
+
+-- |Duty cycle of each complete PWM period (rising edge to rising edge)
+-- of a pin trace.  Periods where the pin doesn't toggle at all (0% and
+-- 100%) have no edges, so they aren't counted.
+dutyCycles :: [(Double, Integer)] -> [Double]
+dutyCycles changes = go [(t, v /= 0) | (t, v) <- changes]
+    where
+        go ((r1, True) : (f, False) : rest@((r2, True) : _)) = (f - r1) / (r2 - r1) : go rest
+        go (_ : rest) = go rest
+        go [] = []
+
+-- |Count values in [0,1] into 'n' equal bins.
+histogram :: Int -> [Double] -> [Int]
+histogram n xs = [M.findWithDefault 0 i counts | i <- [0 .. n - 1]]
+    where
+        counts = M.fromListWith (+)
+            [ (min (n - 1) (max 0 (floor (x * fromIntegral n))), 1)
+            | x <- xs
+            ]
+
+-- |One-sided power spectral density of a signal sampled at 'rate',
+-- by Welch's method: Hann-windowed segments of length 'n' overlapping
+-- by half, mean removed, averaged.  Returns (frequency, power) for
+-- each bin from DC to Nyquist.  This is a direct DFT, which is plenty
+-- for the few thousand samples a simulation produces.
+powerSpectrum :: Double -> Int -> [Double] -> [(Double, Double)]
+powerSpectrum rate n xs
+    | null segments = []
+    | otherwise     =
+        [ (rate * fromIntegral k / fromIntegral n, sum [bin seg k | seg <- segments] / nSegs)
+        | k <- [0 .. n `div` 2]
+        ]
+    where
+        len         = length xs
+        mean        = sum xs / fromIntegral len
+        window      = [0.5 - 0.5 * cos (2 * pi * fromIntegral i / fromIntegral n) | i <- [0 .. n - 1]]
+        scale       = 2 / (rate * sum (map (^ (2 :: Int)) window))
+        segments    =
+            [ zipWith (*) window (map (subtract mean) (take n (drop i xs)))
+            | i <- [0, max 1 (n `div` 2) .. len - n]
+            ]
+        nSegs       = fromIntegral (length segments)
+        bin seg k   = scale * (re * re + im * im)
+            where
+                w  = 2 * pi * fromIntegral k / fromIntegral n
+                re = sum [x * cos (w * fromIntegral i) | (i, x) <- zip [0 :: Int ..] seg]
+                im = sum [x * sin (w * fromIntegral i) | (i, x) <- zip [0 :: Int ..] seg]
+
+-- |The -3dB point of a low-pass spectrum: the first frequency above the
+-- passband reference (the mean power of the non-DC bins below a quarter
+-- of the intended cutoff) where the power drops below half of it.
+cornerFrequency :: Double -> [(Double, Double)] -> Maybe Double
+cornerFrequency cutoff spectrum = case passband of
+    []  -> Nothing
+    _   -> fmap fst (find ((< ref / 2) . snd) (dropWhile ((<= cutoff / 4) . fst) nonDC))
+    where
+        nonDC       = drop 1 spectrum
+        passband    = takeWhile ((<= cutoff / 4) . fst) nonDC
+        ref         = sum (map snd passband) / fromIntegral (length passband)
@@ -1,11 +1,43 @@
 module Development.Shake.AVR
     ( avr_gcc,      avr_gcc'
+    , avr_gcc_with, avr_gcc_with'
+    , avr_gcc_pch,  avr_gcc_pch'
+    , avr_pch,      avr_pch'
+    , avr_pch_report, avr_pch_report'
+    , pchPath
+    , avr_include_tree
+    , avr_include_header
+    , avr_need_include_tree
+    , avr_gamma_header
+    , avr_baud_header
+    , Baud.standardBaudRates
+    , avr_filter
+    , Filter.FilterSpec(..)
+    , Filter.Headroom(..)
+    , Filter.lowpass
+    , Worker.Backend
+    , Worker.localOnly
+    , Worker.workerBackend
     , avr_ld,       avr_ld'
     , avr_objcopy,  avr_objcopy'
     , avr_objdump,  avr_objdump'
     , avr_size,     avr_size'
+    , avr_extract
     
     , avrdude,      avrdude'
+    , avrdude_calibrate, avrdude_calibrate'
+    , avrdude_calibrated, avrdude_calibrated'
+    
+    , serial_capture
+    , bridge_stats
+    , bridge_latency
+    , serial_latency
+    , loopback_latency
+    , simavr,       simavr'
+    , SimAVR.Trace(..)
+    , pwm_report
+    , boot_report
+    , sleep_report
     , AVRDUDE.MemType(..)
     , AVRDUDE.Dir(..)
     , AVRDUDE.Op(..)
@@ -14,10 +46,46 @@ module Development.Shake.AVR
     , AVRDUDE.Actions
     , AVRDUDE.action
     , AVRDUDE.r, AVRDUDE.v, AVRDUDE.w, AVRDUDE.imm
+    
+    , openocd,      openocd'
+    , openocd_flash, openocd_flash'
+    , OpenOCD.ResetMode(..)
+    , OpenOCD.ImageType(..)
+    , OpenOCD.ScriptM
+    , OpenOCD.Script
+    , OpenOCD.raw
+    , OpenOCD.initialize
+    , OpenOCD.reset
+    , OpenOCD.flashProbe
+    , OpenOCD.writeImage, OpenOCD.writeImageErase
+    , OpenOCD.verifyImage
     ) where
 
+import Control.Monad
+import qualified Data.AVR.BridgeStats as BridgeStats
+import qualified Data.AVR.Capture as Capture
+import qualified Data.AVR.ELF as ELF
+import qualified Data.AVR.Latency as Latency
+import qualified Data.AVR.VCD as VCD
+import qualified Data.AVR.Waveform as Waveform
+import Data.Bits
+import qualified Data.ByteString as BS
+import Data.List
+import qualified Data.Map as M
+import Data.Word
 import Development.Shake
+import qualified Development.Shake.AVR.Baud as Baud
+import qualified Development.Shake.AVR.Codegen as Codegen
+import qualified Development.Shake.AVR.Filter as Filter
+import Development.Shake.AVR.Timing
+import Development.Shake.FilePath
 import qualified System.Command.AVRDUDE as AVRDUDE
+import qualified System.Command.CompileWorker as Worker
+import qualified System.Command.OpenOCD as OpenOCD
+import qualified System.Command.SimAVR as SimAVR
+import qualified System.Directory as IO
+import System.Exit
+import Text.Printf
 
 gccDeps cc cFlags src = do
     Stdout cppOut <- command [Traced ""] cc (cFlags ++ ["-M", "-MG", "-E", src])
@@ -27,13 +95,219 @@ avr_gcc = avr_gcc' "avr-gcc"
 avr_gcc' cc cFlags src out = do
     need [src]
     need =<< gccDeps cc cFlags src
-    command_ [] cc (cFlags ++ ["-c", src, "-o", out])
+    timed out $ command_ [] cc (cFlags ++ ["-c", src, "-o", out])
+
+-- Like avr_gcc', but C sources are preprocessed locally and the compile
+-- itself is handed to a 'Worker.Backend' (e.g. 'Worker.workerBackend'
+-- with a list of avr-shake-worker sockets).  If the backend can't take
+-- the job, it's compiled locally.  Other sources go straight to avr_gcc'.
+avr_gcc_with backend = avr_gcc_with' backend "avr-gcc"
+avr_gcc_with' backend cc cFlags src out
+    | takeExtension src /= ".c" = avr_gcc' cc cFlags src out
+    | otherwise                 = do
+        need [src]
+        need =<< gccDeps cc cFlags src
+        timed out $ do
+            let pre = out <.> "i"
+                flags = compileOnlyFlags cFlags
+            flip actionFinally (removeIfExists pre) $ do
+                command_ [] cc (cFlags ++ ["-E", src, "-o", pre])
+                preprocessed <- liftIO (BS.readFile pre)
+                result <- liftIO (backend cc flags preprocessed)
+                case result of
+                    Nothing -> command_ [] cc (flags ++ ["-c", pre, "-o", out])
+                    Just (code, err, obj) -> do
+                        when (not (null err)) (putNormal err)
+                        case code of
+                            ExitSuccess     -> liftIO (BS.writeFile out obj)
+                            ExitFailure _   -> fail ("remote compile failed: " ++ src)
+
+removeIfExists file = do
+    exists <- IO.doesFileExist file
+    when exists (IO.removeFile file)
+
+-- flags that only matter to the preprocessor (and may name local paths)
+compileOnlyFlags (flag : _ : more)
+    | flag `elem` ["-include", "-imacros", "-isystem", "-iquote", "-idirafter"]
+        = compileOnlyFlags more
+compileOnlyFlags (flag : more)
+    | any (`isPrefixOf` flag) ["-I", "-D", "-U", "-isystem", "-iquote", "-idirafter"]
+        = compileOnlyFlags more
+    | otherwise
+        = flag : compileOnlyFlags more
+compileOnlyFlags [] = []
+
+-- Precompiled headers.  'pchPath dir cFlags umbrella' names the header
+-- that sources "-include" for one flag set, and avr_pch builds it and
+-- its .gch:
+--
+-- >    let pch = pchPath "build/pch" cFlags "conf/pch.h"
+-- >    [pch, pch <.> "gch"] &*> \_ -> avr_pch cFlags "conf/pch.h" pch
+-- >    ... avr_gcc_pch pch cFlags src out
+--
+-- The flags are hashed into the path, so changing them builds a new
+-- .gch instead of reusing a stale one, and the umbrella header's
+-- dependency scan rebuilds it when anything it includes changes.
+-- (gcc also quietly ignores a .gch built with incompatible flags.)
+pchPath dir cFlags umbrella = dir </> fnv1a (show cFlags) </> takeFileName umbrella
+
+fnv1a :: String -> String
+fnv1a = printf "%016x" . foldl' step (14695981039346656037 :: Word64)
+    where step h c = (h `xor` fromIntegral (fromEnum c)) * 1099511628211
+
+avr_pch = avr_pch' "avr-gcc"
+avr_pch' cc cFlags umbrella pch = do
+    cwd <- liftIO IO.getCurrentDirectory
+    writeFileChanged pch ("#include \"" ++ (cwd </> umbrella) ++ "\"\n")
+    need =<< gccDeps cc cFlags pch
+    timed (pch <.> "gch") $
+        command_ [] cc (cFlags ++ ["-x", "c-header", pch, "-o", pch <.> "gch"])
+
+avr_gcc_pch = avr_gcc_pch' "avr-gcc"
+avr_gcc_pch' cc pch cFlags src out = do
+    need [pch <.> "gch"]
+    avr_gcc' cc (["-include", pch] ++ cFlags) src out
+
+-- Measure what the precompiled header saves across 'objs'.  A
+-- representative source 'src' is compiled twice, one after the other:
+-- with the header, and from a copy of the header with no .gch beside
+-- it, so gcc parses the headers as text.  The saving per compile, times
+-- the number of objects, less what building the .gch cost, is the net
+-- saving.  The compiles' durations are recorded like any other timed
+-- step, under the header's directory.
+avr_pch_report = avr_pch_report' "avr-gcc"
+avr_pch_report' cc cFlags pch src objs = do
+    let dir         = takeDirectory pch </> "report"
+        noPch       = dir </> takeFileName pch
+        withObj     = dir </> "with-pch.o"
+        withoutObj  = dir </> "without-pch.o"
+        compile hdr out = timed out $
+            command_ [] cc (["-include", hdr] ++ cFlags ++ ["-c", src, "-o", out])
+    need [src, pch <.> "gch"]
+    copyFileChanged pch noPch
+    liftIO (removeIfExists (noPch <.> "gch"))
+    compile pch withObj
+    compile noPch withoutObj
+    durations <- mapM recordedDuration [withObj, withoutObj, pch <.> "gch"]
+    case durations of
+        [Just with, Just without, Just gch] -> do
+            let n       = length objs
+                saving  = without - with
+            putNormal $ printf "%s: %s compiles in %.3fs with it, %.3fs without (%.3fs saved)"
+                pch src with without saving
+            putNormal $ printf "%s: %d objects x %.3fs - %.3fs for the .gch = %.2fs net saving"
+                pch n saving gch (fromIntegral n * saving - gch)
+        _ -> fail ("avr_pch_report: no recorded build time for " ++ (pch <.> "gch"))
+
+-- Consolidate a list of include directories into one tree rooted at
+-- the directory containing 'manifest', so the compiler searches one -I
+-- directory instead of dozens.  Every header under each directory goes
+-- to the same relative path in the tree, from the first directory (in
+-- -I order) that has it, which is the one the compiler would have
+-- found.  avr_include_tree writes the manifest, recording where each
+-- header comes from; each header in the tree is then an output of its
+-- own rule, and rules that compile against the tree call
+-- avr_need_include_tree first:
+--
+-- >    includeManifest *> avr_include_tree dirs
+-- >    takeDirectory includeManifest ++ "//*.h" *> avr_include_header includeManifest
+--
+-- Subdirectories that are themselves in the list are left to their own
+-- entry, so their headers aren't mapped a second time under a longer
+-- path.  A header present with different contents in more than one
+-- directory fails the build: anything that expected its own sibling via
+-- a quoted #include would get the winning copy instead.  Headers that
+-- disappear from the source directories are removed from the tree, so
+-- the compiler can't go on finding stale copies.
+avr_include_tree dirs manifest = do
+    let roots = map (dropTrailingPathSeparator . normalise) dirs
+        -- under another root, below this one
+        nested dir hdr = or
+            [ (dir ++ "/") `isPrefixOf` root && (root ++ "/") `isPrefixOf` (dir </> hdr)
+            | root <- roots
+            ]
+    found <- forM roots $ \dir -> do
+        hdrs <- getDirectoryFiles dir ["//*.h"]
+        return [(hdr, [dir]) | hdr <- hdrs, not (nested dir hdr)]
+    let sources = M.fromListWith (flip (++)) (concat found)
+    
+    conflicts <- fmap concat $ forM (M.toList sources) $ \(hdr, srcDirs) ->
+        if length srcDirs < 2 then return [] else do
+            let copies = [dir </> hdr | dir <- srcDirs]
+            need copies
+            contents <- liftIO (mapM BS.readFile copies)
+            return [unwords copies | any (/= head contents) contents]
+    when (not (null conflicts)) $
+        fail $ unlines ("avr_include_tree: headers with conflicting copies:" : conflicts)
+    
+    liftIO $ do
+        exists <- IO.doesFileExist manifest
+        old <- if not exists then return [] else do
+            str <- readFile manifest
+            length str `seq` return [takeWhile (/= '\t') entry | entry <- lines str]
+        forM_ (filter (`M.notMember` sources) old) $ \hdr ->
+            removeIfExists (takeDirectory manifest </> hdr)
+    
+    writeFileChanged manifest $ unlines
+        [ hdr ++ "\t" ++ dir
+        | (hdr, dir : _) <- M.toList sources
+        ]
+
+-- Copy one header into the tree, from where 'manifest' says it comes from.
+avr_include_header manifest out = do
+    sources <- readIncludeManifest manifest
+    let hdr = makeRelative (takeDirectory manifest) out
+    case lookup hdr sources of
+        Just dir    -> copyFileChanged (dir </> hdr) out
+        Nothing     -> fail (out ++ ": not in " ++ manifest)
+
+-- Bring every header in the tree up to date.
+avr_need_include_tree manifest = do
+    sources <- readIncludeManifest manifest
+    need [takeDirectory manifest </> hdr | (hdr, _) <- sources]
+
+readIncludeManifest manifest = do
+    entries <- readFileLines manifest
+    return [(hdr, dir) | entry <- entries, let (hdr, _ : dir) = break (== '\t') entry]
 
 avr_ld = avr_ld' "avr-ld"
 avr_ld' ld ldFlags objs out = do
     need objs
+    reportMakespan objs
     command_ [] ld (ldFlags ++ ["-o", out] ++ objs)
 
+-- Generate a header with a gamma curve for 'bits'-bit outputs, as
+-- "gamma_table", 33 uint16_t PROGMEM entries to be linearly
+-- interpolated (examples/common/fade.h does this).
+avr_gamma_header gamma bits out =
+    writeFileChanged out $ Codegen.cHeader out $
+        [ printf "// x^%g on [0,1], scaled to %d bits, in 32 segments" gamma bits
+        , Codegen.cDefine "GAMMA_BITS" (show bits)
+        , ""
+        ] ++ Codegen.cArray "uint16_t" "gamma_table" (Codegen.gammaTable gamma 32 bits)
+
+-- Generate a header of XMEGA USART baud settings (BSEL, BSCALE and
+-- CLK2X; see Development.Shake.AVR.Baud) for a peripheral clock of
+-- 'f' Hz, for each of 'rates' that can be reached within 'maxError':
+--
+-- >    "baud_table.h" *> avr_baud_header 24000000 0.01 standardBaudRates
+avr_baud_header f maxError rates out =
+    writeFileChanged out (Baud.baudHeader out f maxError rates)
+
+-- Design a fixed-point filter (see Development.Shake.AVR.Filter) and
+-- write it out as a C header, with a report on its formats and
+-- quantization error:
+--
+-- >    ["filter.h", "filter.txt"] &*> \[h, txt] ->
+-- >        avr_filter (lowpass "flicker_filter" 2 2.2 156.25) h txt
+avr_filter spec header report = do
+    let d = Filter.design spec
+    writeFileChanged header (Filter.filterHeader header d)
+    writeFileChanged report (Filter.filterReport d)
+    when (Filter.designOverflows d > 0) $
+        putNormal $ printf "%s: %d overflows in simulation; see %s"
+            header (Filter.designOverflows d) report
+
 avr_objcopy = avr_objcopy' "avr-objcopy"
 avr_objcopy' objcopy fmt flags src out = do
     need [src]
@@ -45,6 +319,19 @@ avr_objdump' objdump src out = do
     Stdout lss <- command [] objdump ["-h", "-S", src]
     writeFileChanged out lss
 
+-- Extract Intel HEX images of several memories (flash, EEPROM, fuses,
+-- lock bits, signature) from an ELF file, reading it only once and
+-- without running avr-objcopy.  Fuse images for individual bytes
+-- ('FuseN', 'LFuse', etc.) contain just that byte at address 0.
+avr_extract elf outs = do
+    need [elf]
+    sections <- liftIO (ELF.readELF elf)
+    forM_ outs $ \(mem, out) -> case ELF.memoryImage mem sections of
+        Just img    -> writeFileChanged out (ELF.encodeIHex img)
+        Nothing     -> fail $ unwords
+            ["avr_extract: memory type", show (AVRDUDE.encodeMemType mem),
+            "has no location in an ELF file (wanted for", show out ++ ")"]
+
 avr_size = avr_size' "avr-size"
 avr_size' avrsizeBin src = do
     need [src]
@@ -56,3 +343,360 @@ avrdude' avrdudeBin mcu opts actions = do
     alwaysRerun
     need (fst (AVRDUDE.actionFiles actions))
     command_ [] avrdudeBin (["-p", mcu] ++ opts ++ AVRDUDE.encodeActions actions)
+
+-- As avrdude/avrdude', but at the bit clock avrdude_calibrate found for
+-- this programmer, part, signature and clock fuses, as the device reads
+-- them back now (at the default clock).  The fastest clock that works
+-- depends on how the part is clocked, so nothing is applied if the
+-- fuses have changed since, or the options set -B themselves.
+avrdude_calibrated = avrdude_calibrated' "avrdude"
+avrdude_calibrated' avrdudeBin mcu opts actions = do
+    alwaysRerun
+    need (fst (AVRDUDE.actionFiles actions))
+    bitclock <- if any ("-B" `isPrefixOf`) opts then return [] else do
+        identity <- readIdentity avrdudeBin mcu opts
+        liftIO (cachedBitclock mcu opts identity)
+    when (null bitclock) $
+        putNormal "avrdude_calibrated: no calibrated bit clock for this device, using the default"
+    command_ [] avrdudeBin (["-p", mcu] ++ opts ++ bitclock ++ AVRDUDE.encodeActions actions)
+
+readIdentity avrdudeBin mcu opts = do
+    Stdout out <- command [] avrdudeBin
+        (["-p", mcu] ++ opts ++ ["-q", "-q"] ++ AVRDUDE.encodeActions (identityActions mcu))
+    return (unwords (words out))
+
+-- read the signature and the fuses that select the part's clock, one
+-- value per line
+identityActions mcu = sequence_
+    [ AVRDUDE.action mem AVRDUDE.R "-" AVRDUDE.Hex
+    | mem <- AVRDUDE.Signature : clockFuses mcu
+    ]
+
+-- XMEGAs are programmed over PDI, which has its own clock, and the TPI
+-- parts pick their clock in software; the rest select it in lfuse,
+-- apart from the few with only one fuse byte.
+clockFuses mcu
+    | "atxmega" `isPrefixOf` mcu                    = []
+    | mcu `elem` ["attiny4", "attiny5", "attiny9", "attiny10", "attiny20", "attiny40"]
+                                                    = []
+    | mcu `elem` ["attiny11", "attiny12", "attiny15"] = [AVRDUDE.Fuse]
+    | otherwise                                     = [AVRDUDE.LFuse]
+
+-- Find the fastest programmer bit clock (avrdude's -B, in microseconds)
+-- at which the device signature and clock fuses still read back
+-- correctly and 'image', which must already be in flash, still
+-- verifies -- twice in a row.  The result is cached per programmer,
+-- part, signature and clock fuses (as read at the default clock), for
+-- avrdude_calibrated to use; after a clock fuse change it no longer
+-- applies, and the part needs calibrating again.
+avrdude_calibrate = avrdude_calibrate' "avrdude"
+avrdude_calibrate' avrdudeBin mcu opts image = do
+    alwaysRerun
+    need [image]
+    let probe extra = do
+            (Exit code, Stdout out) <- command [] avrdudeBin
+                (["-p", mcu] ++ opts ++ extra ++ ["-q", "-q"]
+                    ++ AVRDUDE.encodeActions (identityActions mcu >> AVRDUDE.v AVRDUDE.Flash image))
+            return (code == ExitSuccess, unwords (words out))
+    
+    (ok, identity) <- probe []
+    when (not ok) $ fail "avrdude_calibrate: can't read and verify the device to start with"
+    
+    let search [] = return Nothing
+        search (b : bs) = do
+            results <- replicateM 2 (probe ["-B", show b])
+            if all (== (True, identity)) results
+                then return (Just b)
+                else search bs
+    found <- search candidateBitclocks
+    case found of
+        Nothing -> putNormal "avrdude_calibrate: no faster bit clock works, leaving the default"
+        Just b  -> do
+            liftIO $ do
+                entries <- readBitclockCache
+                let key (p, m, s, _) = (p, m, s)
+                    entry = (programmer opts, mcu, identity, b)
+                IO.createDirectoryIfMissing True (takeDirectory bitclockCache)
+                writeFile bitclockCache (show (entry : filter ((key entry /=) . key) entries))
+            putNormal $ printf "avrdude_calibrate: %s via %s (signature and fuses %s) works at -B %s"
+                mcu (programmer opts) identity (show b)
+
+-- fastest first; anything slower than this is about where avrdude's
+-- defaults already are
+candidateBitclocks :: [Double]
+candidateBitclocks = [0.25, 0.5, 1, 2, 4, 8]
+
+bitclockCache = ".avr-shake" </> "bitclock"
+
+readBitclockCache :: IO [(String, String, String, Double)]
+readBitclockCache = do
+    exists <- IO.doesFileExist bitclockCache
+    if not exists then return [] else do
+        str <- readFile bitclockCache
+        length str `seq` return $ case reads str of
+            [(entries, _)]  -> entries
+            _               -> []
+
+programmer opts = case opts of
+    "-c" : p : _    -> p
+    ('-' : 'c' : p@(_:_)) : _ -> p
+    _ : more        -> programmer more
+    []              -> ""
+
+cachedBitclock mcu opts identity = do
+    entries <- readBitclockCache
+    return $ take 2 $ concat
+        [ ["-B", show b]
+        | (p, m, s, b) <- entries
+        , p == programmer opts, m == mcu, s == identity
+        ]
+
+-- Record everything arriving on some serial ports, given as (device,
+-- baud rate) pairs, for 'seconds' into a timestamped capture file (see
+-- Data.AVR.Capture for the format and a decoder).  The ports are put in
+-- raw mode first (see Capture.configurePort), which works just as well
+-- on the pty end of a stand-in for the real device.
+serial_capture ports seconds out = liftIO $ do
+    forM_ ports $ \(dev, baud) -> Capture.configurePort dev baud
+    Capture.capture (map fst ports) seconds out
+
+-- Read the traffic and error counters from a USB-serial bridge running
+-- the xmega-cdc example's firmware (see Data.AVR.BridgeStats), found
+-- by USB vendor and product ID, and write them to 'out' as a table.
+-- With 'clear', the device zeroes them once they've been read, so each
+-- run covers the time since the last one.
+bridge_stats vid pid clear out = do
+    alwaysRerun
+    stats <- liftIO (BridgeStats.readBridgeStats vid pid clear)
+    let table = BridgeStats.formatBridgeStats stats
+    writeFileChanged out table
+    putNormal table
+
+-- Set a bridge port's low-latency mode (see
+-- Data.AVR.BridgeStats.setBridgeLatency).  The device forgets it when
+-- it's reset.
+bridge_latency vid pid port idle threshold = do
+    alwaysRerun
+    liftIO (BridgeStats.setBridgeLatency vid pid port idle threshold)
+
+-- Benchmark round trips through a serial port that echoes what it's
+-- sent (a bridge port with RXD and TXD tied together): 'count'
+-- exchanges of 'size' bytes, one at a time, summarized in 'out'.
+serial_latency dev baud size count out = do
+    alwaysRerun
+    liftIO (Capture.configurePort dev baud)
+    times <- liftIO (Latency.roundTrips dev size count)
+    latencyReport (Latency.latencyReport dev size times) out
+
+-- The same benchmark against a pseudo-terminal that echoes straight
+-- back, as a baseline for what the host's serial stack alone costs.
+loopback_latency size count out = do
+    alwaysRerun
+    times <- liftIO (Latency.withLoopback (\dev -> Latency.roundTrips dev size count))
+    latencyReport (Latency.latencyReport "loopback" size times) out
+
+latencyReport report out = do
+    writeFileChanged out report
+    putNormal report
+
+-- Run an ELF file under simavr for 'seconds' (of wall clock time; the
+-- simulated time covered depends on how fast simavr runs) and record
+-- the traced signals in a VCD file.  'opts' are passed to run_avr as-is.
+simavr = simavr' "run_avr"
+simavr' runAvr mcu freq opts traces seconds elf vcd = do
+    need [elf]
+    liftIO (SimAVR.simavr runAvr mcu freq opts traces seconds elf vcd)
+
+-- Summarize PWM channels traced by 'simavr'.  Each channel is a pair of
+-- VCD signal names: the duty-cycle register (a RegisterTrace) and the
+-- pin it drives (a PinTrace).  The report gives the register's effective
+-- update rate and jitter, a histogram of the pin's duty cycles and the
+-- power spectrum of the register's values.  If a 'cutoff' frequency is
+-- given, the spectrum's -3dB point is checked against it, with a warning
+-- if they're more than 25% apart.
+pwm_report vcd channels cutoff out = do
+    need [vcd]
+    signals <- liftIO (VCD.readVCD vcd)
+    let signal name = maybe (fail (vcd ++ ": no signal named " ++ name))
+            (return . VCD.signalChanges) (VCD.findSignal name signals)
+    
+    sections <- forM channels $ \(reg, pin) -> do
+        regChanges <- signal reg
+        pinChanges <- signal pin
+        stats <- maybe (fail (vcd ++ ": too few updates of " ++ reg ++ " to analyze")) return
+            (Waveform.updateStats regChanges)
+        
+        let period      = Waveform.updatePeriod stats
+            samples     = map fromInteger (Waveform.resample period regChanges)
+            spectrum    = Waveform.powerSpectrum (1 / period) (segmentLength (length samples)) samples
+            corner      = cutoff >>= \fc -> Waveform.cornerFrequency fc spectrum
+        
+        putNormal $ printf "%s: %.2f Hz updates, %.1f us rms jitter" reg (1 / period) (1e6 * Waveform.updateJitterRMS stats)
+        case (cutoff, corner) of
+            (Just fc, Just fm) | abs (fm - fc) > 0.25 * fc
+                -> putNormal $ printf "%s: WARNING: -3dB at %.2f Hz, intended %.2f Hz" reg fm fc
+            (Just fc, Nothing)
+                -> putNormal $ printf "%s: no -3dB point found (intended %.2f Hz); simulate for longer" reg fc
+            _   -> return ()
+        
+        return (pwmReport reg pin stats (Waveform.dutyCycles pinChanges) spectrum cutoff corner)
+    
+    writeFileChanged out (unlines (intercalate [""] sections))
+    where
+        -- longest power-of-two segment giving at least 7 overlapping segments
+        segmentLength n = last (16 : takeWhile (\s -> 4 * s <= n) (map (2 ^) [5 .. 10 :: Int]))
+
+-- Summarize a boot traced by 'simavr' from reset: when the 'output'
+-- register (a RegisterTrace) is first set, and how many EEPROM byte
+-- writes were started, from a RegisterTrace of 'eeprom' (EECR, say)
+-- masked to its write-enable bit, and when.
+boot_report vcd output eeprom out = do
+    need [vcd]
+    signals <- liftIO (VCD.readVCD vcd)
+    let signal name = maybe (fail (vcd ++ ": no signal named " ++ name))
+            (return . VCD.signalChanges) (VCD.findSignal name signals)
+    
+    first <- signal output >>= \changes -> case [t | (t, v) <- changes, v /= 0] of
+        t : _   -> return t
+        []      -> fail (vcd ++ ": " ++ output ++ " never set; simulate for longer")
+    writes <- fmap (\changes -> [t | (t, v) <- changes, v /= 0]) (signal eeprom)
+    
+    let ms t    = 1e3 * t :: Double
+        report  = unlines $
+            [ printf "%s: first set %.3f ms after reset" output (ms first)
+            , printf "%s: %d EEPROM byte writes, %d of them before %s was set"
+                eeprom (length writes) (length (takeWhile (< first) writes)) output
+            ] ++
+            [ printf "%s: writes started between %.3f and %.3f ms" eeprom (ms (head writes)) (ms (last writes))
+            | not (null writes)
+            ]
+    writeFileChanged out report
+    putNormal report
+
+-- Summarize how much a firmware that sleeps between interrupts is awake,
+-- from two pins traced by 'simavr' (see FRAME_TRACE in the examples'
+-- frames.h): 'awake' is high from each wakeup until the CPU next
+-- sleeps, and 'frame' toggles at the end of every frame.  Only whole
+-- frames count, so startup is left out.  'freq' is the CPU clock.
+sleep_report vcd awake frame freq out = do
+    need [vcd]
+    signals <- liftIO (VCD.readVCD vcd)
+    let signal name = maybe (fail (vcd ++ ": no signal named " ++ name))
+            (return . VCD.signalChanges) (VCD.findSignal name signals)
+    
+    edges   <- fmap (map (\(t, v) -> (t, v /= 0))) (signal awake)
+    frames  <- fmap (filter (> 0) . map fst) (signal frame)
+    when (length frames < 3) $
+        fail (vcd ++ ": too few frames to measure; simulate for longer")
+    
+    let t0      = head frames
+        t1      = last frames
+        window  = t1 - t0
+        n       = fromIntegral (length frames - 1) :: Double
+        
+        highs (Just a) ((t, False) : more)  = (a, t) : highs Nothing more
+        highs Nothing  ((t, True)  : more)  = highs (Just t) more
+        highs state    (_ : more)           = highs state more
+        highs _        []                   = []
+        
+        wakeups = fromIntegral (length [t | (t, True) <- edges, t >= t0, t < t1]) :: Double
+        active  = sum [max 0 (min b t1 - max a t0) | (a, b) <- highs Nothing edges]
+        cycles  = active * fromIntegral freq
+        report  = unlines
+            [ printf "%s: %.0f frames in %.3f s simulated, %.2f frames/s" vcd n window (n / window)
+            , printf "  wakeups:        %10.1f /s  %8.1f /frame" (wakeups / window) (wakeups / n)
+            , printf "  active cycles:  %10.0f /s  %8.0f /frame  (awake %.2f%% of the time)"
+                (cycles / window) (cycles / n) (100 * active / window)
+            ]
+    writeFileChanged out report
+    putNormal report
+
+pwmReport reg pin stats duties spectrum cutoff corner = concat
+    [ [ reg ++ " / " ++ pin
+      , printf "  updates:    %d at %.3f Hz (%.1f us period)"
+            (Waveform.updateCount stats) (1 / period) (1e6 * period)
+      , printf "  jitter:     %.2f us rms, %.2f us max"
+            (1e6 * Waveform.updateJitterRMS stats) (1e6 * Waveform.updateJitterMax stats)
+      , printf "  duty cycle: %d periods" (length duties)
+      ]
+    , [ printf "    %3d%% - %3d%%  %5.1f%%  %s" (lo :: Int) (lo + 5) pct (replicate (round (pct / 2)) '#')
+      | (lo, count) <- zip [0, 5 ..] (Waveform.histogram 20 duties)
+      , let pct = 100 * fromIntegral count / fromIntegral (max 1 (length duties)) :: Double
+      ]
+    , [ "  spectrum:   " ++ maybe "no -3dB point found" (printf "-3dB at %.2f Hz") corner
+            ++ maybe "" (printf " (intended %.2f Hz)") cutoff
+      ]
+    , [ printf "    %7.2f Hz  %6.1f dB" f (10 * logBase 10 (p / peak))
+      | (f, p) <- takeWhile inRange (drop 1 spectrum)
+      , p > 0
+      ]
+    ]
+    where
+        period  = Waveform.updatePeriod stats
+        peak    = maximum (1e-30 : map snd (drop 1 spectrum))
+        inRange (f, _) = maybe True (\fc -> f <= 4 * fc) cutoff
+
+openocd = openocd' "openocd"
+openocd' openocdBin cfgs script = do
+    alwaysRerun
+    need (OpenOCD.scriptFiles script)
+    runOpenOCD openocdBin cfgs script
+
+runOpenOCD openocdBin cfgs script =
+    command_ [] openocdBin (openocdArgs cfgs script)
+
+openocdArgs cfgs script = concat [["-f", cfg] | cfg <- cfgs]
+    ++ OpenOCD.encodeScript (script >> OpenOCD.shutdown)
+
+-- Program a raw binary image at address 'base' without a chip erase,
+-- writing only the sectors that differ from the image written by the
+-- last successful run, which is kept next to the input as
+-- "<img>.flashed".  That record only describes this checkout, so the
+-- whole image is then verified against the device (openocd checksums
+-- it on the target where it can, so this is much cheaper than writing
+-- it); if another board or another tool has been at the flash, the
+-- verify fails and the whole image is written instead.  'sectorSize'
+-- must be the flash bank's erase granularity as openocd sees it ("flash
+-- info"), since openocd erases whole sectors before writing.  'setup'
+-- runs after "reset init", so it's the place for "flash probe" and any
+-- chip-specific configuration.
+openocd_flash = openocd_flash' "openocd"
+openocd_flash' openocdBin cfgs setup sectorSize base img = do
+    alwaysRerun
+    need [img]
+    let flashed = img <.> "flashed"
+    new <- liftIO (BS.readFile img)
+    old <- liftIO $ do
+        exists <- IO.doesFileExist flashed
+        if exists then BS.readFile flashed else return BS.empty
+    
+    let runs    = OpenOCD.changedRuns sectorSize new old
+        chunks  = [ (img <.> ("part" ++ show n), base + toInteger offset, bytes)
+                  | (n, (offset, bytes)) <- zip [0 :: Int ..] runs
+                  ]
+        written = sum [BS.length bytes | (_, bytes) <- runs]
+        script writes = do
+            OpenOCD.initialize
+            OpenOCD.reset OpenOCD.Init
+            setup
+            writes
+            OpenOCD.verifyImage img base OpenOCD.BinImage
+            OpenOCD.reset OpenOCD.Run
+    
+    matched <- flip actionFinally (mapM_ removeIfExists [file | (file, _, _) <- chunks]) $ do
+        liftIO $ forM_ chunks $ \(file, _, bytes) -> BS.writeFile file bytes
+        Exit code <- command [] openocdBin (openocdArgs cfgs (script
+            (sequence_ [OpenOCD.writeImageErase file addr OpenOCD.BinImage | (file, addr, _) <- chunks])))
+        return (code == ExitSuccess)
+    
+    if matched
+        then putNormal $ if null runs
+            then img ++ ": flash is up to date"
+            else concat
+                [ img, ": wrote ", show written, " of ", show (BS.length new)
+                , " bytes in ", show (length runs), " run(s)"
+                ]
+        else do
+            putNormal (img ++ ": device doesn't match " ++ flashed ++ "; writing the whole image")
+            runOpenOCD openocdBin cfgs (script (OpenOCD.writeImageErase img base OpenOCD.BinImage))
+    liftIO (BS.writeFile flashed new)
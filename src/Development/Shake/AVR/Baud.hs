@@ -0,0 +1,105 @@
+-- |Baud rate settings for the XMEGA USART's fractional baud rate
+-- generator, worked out ahead of time so firmware can look them up
+-- instead of searching BSEL/BSCALE at runtime.
+--
+-- For a peripheral clock f, BSEL (12 bits) and BSCALE (-7..7) give
+--
+-- >    f / (2^BSCALE * n * (BSEL + 1))         BSCALE >= 0
+-- >    f / (n * (BSEL / 2^-BSCALE + 1))        BSCALE < 0
+--
+-- where n is 16, or 8 with CLK2X.  Negative BSCALE makes the divisor
+-- fractional, which is what gets the standard rates (nearly) exact.
+module Development.Shake.AVR.Baud
+    ( BaudSetting(..)
+    , standardBaudRates
+    , xmegaBaud
+    , baudHeader
+    ) where
+
+import Data.Bits
+import Data.List
+import Data.Ord
+import Development.Shake.AVR.Codegen
+import Text.Printf
+
+data BaudSetting = BaudSetting
+    { baudRate      :: Integer  -- ^ requested
+    , baudBSEL      :: Integer
+    , baudBSCALE    :: Int
+    , baudCLK2X     :: Bool
+    , baudActual    :: Double
+    , baudError     :: Double   -- ^ relative
+    }
+
+-- |The usual rates, up to 2 Mbaud.
+standardBaudRates :: [Integer]
+standardBaudRates =
+    [ 300, 600, 1200, 2400, 4800, 9600, 14400, 19200, 28800, 38400
+    , 57600, 76800, 115200, 230400, 250000, 460800, 500000, 921600
+    , 1000000, 1500000, 2000000
+    ]
+
+-- |'xmegaBaud f maxError rate' picks a setting for 'rate' with a
+-- peripheral clock of 'f' Hz, within 'maxError' (relative): the closest
+-- one without CLK2X (which halves the receiver's oversampling) if there
+-- is one, otherwise the closest with it.  Ties go to non-negative
+-- BSCALE.
+xmegaBaud :: Integer -> Double -> Integer -> Maybe BaudSetting
+xmegaBaud f maxError rate =
+    case partition (not . baudCLK2X) (filter ok candidates) of
+        ([], [])    -> Nothing
+        ([], fast)  -> Just (best fast)
+        (normal, _) -> Just (best normal)
+    where
+        ok s        = abs (baudError s) <= maxError
+        best        = minimumBy (comparing (\s -> (abs (baudError s), baudBSCALE s < 0)))
+        candidates  =
+            [ BaudSetting rate bsel scale clk2x actual (actual / fromInteger rate - 1)
+            | clk2x <- [False, True]
+            , scale <- [-7 .. 7]
+            , let n     = if clk2x then 8 else 16
+                  ratio = fromInteger f / (n * fromInteger rate) :: Double
+                  bsel
+                    | scale >= 0    = round (ratio / 2 ^^ scale) - 1
+                    | otherwise     = round ((ratio - 1) * 2 ^^ negate scale)
+                  actual
+                    | scale >= 0    = fromInteger f / (2 ^^ scale * n * fromInteger (bsel + 1))
+                    | otherwise     = fromInteger f / (n * (fromInteger bsel / 2 ^^ negate scale + 1))
+            , bsel >= 0 && bsel <= 4095
+            ]
+
+-- |A header of the settings for the given rates that can be reached
+-- within 'maxError', as parallel PROGMEM arrays: baud_rates (uint32),
+-- baud_ctrl (uint16: BAUDCTRLB in the high byte, BAUDCTRLA in the low)
+-- and baud_clk2x (uint8), BAUD_RATES long.  Rates that can't be
+-- reached are listed in a comment.
+baudHeader :: FilePath -> Integer -> Double -> [Integer] -> String
+baudHeader path f maxError rates = cHeader path $
+    [ printf "// XMEGA USART settings for a %d Hz peripheral clock, within %g%%" f (100 * maxError)
+    , "//"
+    , "//      rate  BSEL BSCALE CLK2X      actual   error"
+    ] ++
+    [ printf "// %9d  %4d %6d %5s %11.1f %+6.3f%%"
+        (baudRate s) (baudBSEL s) (baudBSCALE s) (if baudCLK2X s then "yes" else "no")
+        (baudActual s) (100 * baudError s)
+    | s <- settings
+    ] ++
+    [ "//"
+    | not (null missing)
+    ] ++
+    [ "// not reachable: " ++ intercalate ", " (map show missing)
+    | not (null missing)
+    ] ++
+    [ ""
+    , cDefine "BAUD_F_PER" (show f ++ "UL")
+    , cDefine "BAUD_RATES" (show (length settings))
+    , printf "#define BAUD_MAX_ERROR %.3f // %%, of the rates below" (100 * maximum (0 : map (abs . baudError) settings))
+    , ""
+    ] ++ cArray "uint32_t" "baud_rates" (map baudRate settings)
+    ++ cArray "uint16_t" "baud_ctrl" (map ctrl settings)
+    ++ cArray "uint8_t" "baud_clk2x" [if baudCLK2X s then 1 else 0 | s <- settings]
+    where
+        results     = [(rate, xmegaBaud f maxError rate) | rate <- rates]
+        settings    = [s | (_, Just s) <- results]
+        missing     = [rate | (rate, Nothing) <- results]
+        ctrl s      = (toInteger (baudBSCALE s) .&. 0xF) `shiftL` 12 .|. baudBSEL s
@@ -0,0 +1,105 @@
+-- |Helpers for generating C headers of constants and PROGMEM tables,
+-- so tables that are tedious or error-prone to compute by hand can be
+-- built from their definitions.
+module Development.Shake.AVR.Codegen
+    ( cHeader
+    , cDefine
+    , cArray
+    , gammaTable
+    , csd
+    , cMulConst
+    ) where
+
+import Data.Char
+import Data.List
+import System.FilePath
+import Text.Printf
+
+-- |A complete header: a note saying where it came from, an include
+-- guard derived from the file name, and the includes PROGMEM tables need.
+cHeader :: FilePath -> [String] -> String
+cHeader path body = unlines $
+    [ "// generated by avr-shake; do not edit"
+    , ""
+    , "#ifndef " ++ guard
+    , "#define " ++ guard
+    , ""
+    , "#include <avr/pgmspace.h>"
+    , "#include <stdint.h>"
+    , ""
+    ] ++ body ++
+    [ ""
+    , "#endif"
+    ]
+    where
+        guard = map (\c -> if isAlphaNum c then toUpper c else '_') (takeFileName path)
+
+cDefine :: String -> String -> String
+cDefine name value = "#define " ++ name ++ " " ++ value
+
+-- |'cArray ty name xs' declares a static PROGMEM array of type 'ty',
+-- 8 right-aligned values to a line.
+cArray :: String -> String -> [Integer] -> [String]
+cArray ty name xs =
+    printf "static const %s %s[%d] PROGMEM = {" ty name (length xs)
+    : map row (chunk xs)
+    ++ ["};"]
+    where
+        width   = maximum (1 : map (length . show) xs)
+        row     = ("   " ++) . concatMap (\x -> ' ' : pad (show x) ++ ",")
+        pad s   = replicate (width - length s) ' ' ++ s
+        chunk [] = []
+        chunk ys = let (a, b) = splitAt 8 ys in a : chunk b
+
+-- |'gammaTable gamma segments bits' samples x^gamma at 'segments' + 1
+-- evenly spaced points in [0,1], scaled to 'bits' bits, for linear
+-- interpolation between them.
+gammaTable :: Double -> Int -> Int -> [Integer]
+gammaTable gamma segments bits =
+    [ round ((fromIntegral i / fromIntegral segments) ** gamma * top)
+    | i <- [0 .. segments]
+    ]
+    where top = 2 ^^ bits - 1 :: Double
+
+-- |Canonical signed-digit form of an integer: (sign, exponent) pairs,
+-- most significant first, with no two adjacent exponents.  It has the
+-- fewest nonzero digits of any signed binary form, so it's the
+-- cheapest way to multiply by a constant with shifts and adds.
+csd :: Integer -> [(Integer, Int)]
+csd = reverse . go 0
+    where
+        go _ 0 = []
+        go e n
+            | even n    = go (e + 1) (n `div` 2)
+            | otherwise = (d, e) : go (e + 1) ((n - d) `div` 2)
+            where d = 2 - n `mod` 4
+
+-- |'cMulConst name k' defines 'static inline int32_t name(int16_t x)',
+-- returning k * x exactly.  Where the core has MUL that's a plain
+-- multiply; where it doesn't, libgcc would multiply a bit at a time,
+-- so it's a sequence of shifts and adds from k's 'csd' form instead
+-- (in Horner order, so it shifts no further than k's top bit).
+cMulConst :: String -> Integer -> [String]
+cMulConst name k =
+    [ printf "// x * %d = x * (%s)" k (intercalate " " (map digit ds))
+    , printf "static inline int32_t %s(int16_t x) {" name
+    , "#ifdef __AVR_HAVE_MUL__"
+    , printf "    return %dL * x;" k
+    , "#else"
+    ] ++ body ++
+    [ "#endif"
+    , "}"
+    ]
+    where
+        ds = csd k
+        digit (sign, e) = printf "%s2^%d" (if sign < 0 then "-" else "+") e :: String
+        body = case ds of
+            [] -> ["    return 0;"]
+            (sign, _) : _ ->
+                printf "    int32_t p = %s(int32_t) x;" (if sign < 0 then "-" else "")
+                : zipWith step ds (tail ds) ++
+                [ if e == 0 then "    return p;" else printf "    return p << %d;" e
+                | let e = snd (last ds)
+                ]
+        step (_, e0) (sign, e1) =
+            printf "    p = (p << %d) %s x;" (e0 - e1) (if sign < 0 then "-" else "+")
@@ -0,0 +1,367 @@
+-- |Fixed-point IIR low-pass filters for 8-bit cores, generated as C.
+--
+-- A 'FilterSpec' is designed as a Butterworth filter (bilinear transform
+-- with prewarping) and split into biquad sections.  Each section is
+-- implemented in transposed direct form 2 with its numerator scaled to
+-- (1, 2, 1), so the feed-forward multiplies are shifts, 16-bit state
+-- and Q14 feedback coefficients.  Each section's state gets as many
+-- fractional bits as its bound (see 'Headroom') allows, and the whole
+-- thing is simulated bit-exactly to measure the quantization error
+-- against a floating-point version.  Where a section has fewer
+-- fractional bits than its input, the bits shifted out are fed back into
+-- the next sample rather than rounded away, so they can't bias the output.
+--
+-- The feedback multiplies are by constants, so on cores without MUL
+-- they're generated as shift-add sequences (see 'cMulConst'), and the
+-- output can be scaled to a given standard deviation the same way, so
+-- the caller doesn't need to divide it.
+module Development.Shake.AVR.Filter
+    ( FilterSpec(..)
+    , Headroom(..)
+    , lowpass
+    , Design(..)
+    , Section(..)
+    , design
+    , filterHeader
+    , filterReport
+    ) where
+
+import Data.Bits
+import Data.List
+import Development.Shake.AVR.Codegen
+import Text.Printf
+
+data FilterSpec = FilterSpec
+    { filterName        :: String   -- ^ name of the generated C function
+    , filterOrder       :: Int      -- ^ even; one biquad per 2
+    , filterCutoff      :: Double   -- ^ -3dB frequency, Hz
+    , filterRate        :: Double   -- ^ sample (update) rate, Hz
+    , filterInputFrac   :: Int      -- ^ fractional bits of the int8 input
+    , filterInputSigma  :: Double   -- ^ std dev of the input, in input counts
+    , filterHeadroom    :: Headroom
+    , filterOutputSigma :: Maybe Double -- ^ scale the output to this std dev, in counts
+    , filterChannels    :: Int      -- ^ independent copies of the state; if more
+                                    --   than 1, they're arrays and the function
+                                    --   takes a channel number
+    }
+
+-- |How big each section's state may get, which decides how many
+-- fractional bits it can have.
+data Headroom
+    = WorstCase         -- ^ no input sequence can overflow
+    | Sigmas Double     -- ^ this many standard deviations of the state
+                        --   for normally distributed input: more
+                        --   precision, but extreme inputs will wrap
+
+-- |A filter taking int8 samples with 5 fractional bits and standard
+-- deviation 32 (what the flicker examples' normal() produces), sized
+-- for the worst case, with unscaled output and one channel.
+lowpass :: String -> Int -> Double -> Double -> FilterSpec
+lowpass name order cutoff rate = FilterSpec name order cutoff rate 5 32 WorstCase Nothing 1
+
+data Section = Section
+    { sectionA1         :: Double
+    , sectionA2         :: Double
+    , sectionQA1        :: Integer  -- ^ a1 in Q14
+    , sectionQA2        :: Integer  -- ^ a2 in Q14
+    , sectionFrac       :: Int      -- ^ fractional bits of the state and output
+    , sectionBound      :: Double   -- ^ bound on the state, in real units
+    }
+
+data Design = Design
+    { designSpec        :: FilterSpec
+    , designSections    :: [Section]
+    , designScale       :: Maybe (Integer, Int) -- ^ output multiplied by k / 2^s
+    , designOutputSigma :: Double   -- ^ in output counts
+    , designErrorRMS    :: Double   -- ^ vs floating point, in output counts
+    , designErrorMean   :: Double
+    , designOverflows   :: Int      -- ^ in the simulation
+    }
+
+coefShift :: Int
+coefShift = 14
+
+design :: FilterSpec -> Design
+design spec
+    | odd (filterOrder spec) || filterOrder spec < 2
+        = error "Development.Shake.AVR.Filter: filter order must be even and at least 2"
+    | otherwise = Design spec sections scale sigma (rms errs) (mean errs) overflows
+    where
+        coefs       = butterworth (filterOrder spec) (filterCutoff spec) (filterRate spec)
+        quantized   = [(quantize a1, quantize a2) | (a1, a2) <- coefs]
+        quantize a  = round (a * 2 ^ coefShift)
+        real q      = fromInteger q / 2 ^ coefShift
+
+        -- bounds use the quantized coefficients, since those are what run
+        inputMax    = 128 / 2 ^^ filterInputFrac spec
+        inputSigma  = filterInputSigma spec / 2 ^^ filterInputFrac spec
+        responses   = stateResponses [(real q1, real q2) | (q1, q2) <- quantized]
+        bounds      =
+            [ case filterHeadroom spec of
+                WorstCase   -> inputMax * maximum (map (sum . map abs) hs)
+                Sigmas k    -> k * inputSigma * maximum (map (sqrt . sum . map (^ (2 :: Int))) hs)
+            | hs <- responses
+            ]
+        sections    =
+            [ Section a1 a2 q1 q2 (floor (logBase 2 (32767 / b))) b
+            | ((a1, a2), (q1, q2), b) <- zip3 coefs quantized bounds
+            ]
+
+        inputs      = map (clamp8 . round . (filterInputSigma spec *)) (take 40000 (normals 1))
+        unscaled    = runFixed (filterInputFrac spec) sections inputs
+        scale       = fmap (scaleFactor . (/ rms (map fromInteger (settled (map fst unscaled)))))
+                        (filterOutputSigma spec)
+        fixed       = [(applyScale scale y, ovf || out16 (applyScale scale y)) | (y, ovf) <- unscaled]
+        gain        = 2 ^^ outFrac * maybe 1 (\(k, sh) -> fromInteger k / 2 ^^ sh) scale
+        float       = runFloat [(real q1, real q2) | (q1, q2) <- quantized]
+                        [fromInteger x / 2 ^^ filterInputFrac spec | x <- inputs]
+        outFrac     = sectionFrac (last sections)
+        settled     = drop 1000
+        outputs     = settled (map fst fixed)
+        errs        = zipWith (\y r -> fromInteger y - r * gain) outputs (settled float)
+        sigma       = rms (map fromInteger outputs)
+        overflows   = length (filter id (map snd fixed))
+
+-- k / 2^s within 0.5% of a gain, with the smallest k that gets there
+scaleFactor :: Double -> (Integer, Int)
+scaleFactor g = head ([ks | ks@(k, sh) <- map approx [0 .. 24], abs (fromInteger k / 2 ^^ sh - g) <= 0.005 * g] ++ [approx 24])
+    where approx sh = (round (g * 2 ^^ sh), sh)
+
+applyScale :: Maybe (Integer, Int) -> Integer -> Integer
+applyScale Nothing y = y
+applyScale (Just (k, sh)) y
+    | sh > 0    = (k * y + bit (sh - 1)) `shiftR` sh
+    | otherwise = k * y
+
+out16 :: Integer -> Bool
+out16 v = v < -32768 || v > 32767
+
+clamp8 :: Integer -> Integer
+clamp8 = max (-128) . min 127
+
+mean, rms :: [Double] -> Double
+mean xs = sum xs / fromIntegral (length xs)
+rms xs  = sqrt (mean (map (^ (2 :: Int)) xs))
+
+-- |(a1, a2) of each biquad section of a digital Butterworth low-pass
+-- filter (numerator (1, 2, 1) up to a gain), highest Q first: section i
+-- has Q = 1 / (2 sin ((2i + 1) pi / 2n)).  Nothing relies on the order;
+-- 'design' bounds each section's state from the cascade as it stands.
+butterworth :: Int -> Double -> Double -> [(Double, Double)]
+butterworth order cutoff rate =
+    [ ((2 * b0 - 2 * k * k) / a0, (k * k - b1 * k + b0) / a0)
+    | i <- [0 .. order `div` 2 - 1]
+    , let theta = pi / 2 + pi * fromIntegral (2 * i + 1) / fromIntegral (2 * order)
+          b1    = -2 * wa * cos theta
+          b0    = wa * wa
+          a0    = k * k + b1 * k + b0
+    ]
+    where
+        k   = 2 * rate
+        wa  = k * tan (pi * cutoff / rate)
+
+-- Impulse responses (from the filter's input) of each section's y, d1
+-- and d2, long enough for the poles to have died away.
+stateResponses :: [(Double, Double)] -> [[[Double]]]
+stateResponses coefs = transpose' (take n (runStates coefs (1 : repeat 0)))
+    where
+        n = 20000
+        transpose' steps = [ [map (!! j) (map (!! i) steps) | j <- [0 .. 2]] | i <- [0 .. length coefs - 1] ]
+
+-- per sample, per section: [y, d1, d2] after the update
+runStates :: [(Double, Double)] -> [Double] -> [[[Double]]]
+runStates coefs = go (map (const (0, 0)) coefs)
+    where
+        go _ [] = []
+        go states (x : xs) = map snd stepped : go (map fst stepped) xs
+            where
+                stepped = snd (mapAccumL section x (zip coefs states))
+                section u ((a1, a2), (d1, d2)) =
+                    let y   = u + d1
+                        d1' = 2 * u - a1 * y + d2
+                        d2' = u - a2 * y
+                    in (y, ((d1', d2'), [y, d1', d2']))
+
+runFloat :: [(Double, Double)] -> [Double] -> [Double]
+runFloat coefs xs = [head (last step) | step <- runStates coefs xs]
+
+-- Bit-exact model of the generated C.  Returns each output and whether
+-- anything overflowed 16 bits on that sample.
+runFixed :: Int -> [Section] -> [Integer] -> [(Integer, Bool)]
+runFixed inFrac sections = go (map (const (0, 0, 0)) sections)
+    where
+        go _ [] = []
+        go states (x : xs) = (y, overflow) : go states' xs
+            where
+                ((y, _, overflow), states') = mapAccumL section (x, inFrac, False) (zip sections states)
+        section (u, frac, ovf) (s, (d1, d2, r)) = ((y, sectionFrac s, ovf || any out16 [u', y, d1', d2']), (d1', d2', r'))
+            where
+                (u', r') = rescale (sectionFrac s - frac) u r
+                y   = u' + d1
+                d1' = 2 * u' - mulQ (sectionQA1 s) y + d2
+                d2' = u' - mulQ (sectionQA2 s) y
+        mulQ q v = (q * v + bit (coefShift - 1)) `shiftR` coefShift
+
+-- Changes a value's fractional bits.  The bits a right shift drops are
+-- carried into the next sample's shift (first-order error feedback), so
+-- the rounding error has no DC component: rounding or truncating would
+-- bias the output, since these sections have very high DC gain.
+rescale :: Int -> Integer -> Integer -> (Integer, Integer)
+rescale n v r
+    | n >= 0    = (v `shiftL` n, 0)
+    | otherwise = (t `shiftR` negate n, t .&. (bit (negate n) - 1))
+    where t = v + r
+
+-- deterministic N(0,1) samples (xorshift32 and Box-Muller), so the
+-- report is reproducible
+normals :: Integer -> [Double]
+normals seed = pairs (map toUnit (tail (iterate xorshift seed)))
+    where
+        xorshift s0 =
+            let s1 = (s0 `xor` (s0 `shiftL` 13)) .&. 0xFFFFFFFF
+                s2 = s1 `xor` (s1 `shiftR` 17)
+            in (s2 `xor` (s2 `shiftL` 5)) .&. 0xFFFFFFFF
+        toUnit s = (fromInteger s + 1) / 4294967297
+        pairs (u1 : u2 : us) =
+            let r = sqrt (-2 * log u1)
+            in r * cos (2 * pi * u2) : r * sin (2 * pi * u2) : pairs us
+        pairs _ = []
+
+-- |The generated C header: UPDATE_RATE, FILTER_STDDEV (the output's
+-- standard deviation for the design input, in output counts),
+-- FILTER_FRAC (the output's fractional bits) or, if the output is
+-- scaled, FILTER_SCALE (the factor applied to it), and the filter
+-- function, taking an int8 and returning an int16.  With more than one
+-- channel, FILTER_CHANNELS is defined too, the state is a
+-- structure of arrays indexed by channel, and the function takes the
+-- channel number first.
+filterHeader :: FilePath -> Design -> String
+filterHeader path d = cHeader path $
+    [ printf "// order-%d Butterworth low-pass, -3dB at %g Hz for %g Hz updates,"
+        (filterOrder spec) (filterCutoff spec) (filterRate spec)
+    , "// as biquads in transposed direct form 2 with b = (1, 2, 1)."
+    , "// \"/* x:y */\" annotations give significant bits and (negated)"
+    , "// base-2 exponent."
+    , cDefine "UPDATE_RATE" (printf "%g" (filterRate spec))
+    , cDefine "FILTER_STDDEV" (printf "%.4g" (designOutputSigma d))
+    , case designScale d of
+        Nothing         -> cDefine "FILTER_FRAC" (show outFrac)
+        Just (k, sh)    -> cDefine "FILTER_SCALE" (printf "(%d.0 / %d)" k (bit sh :: Integer))
+    ] ++
+    [ cDefine "FILTER_CHANNELS" (show channels) | channels > 1 ] ++ concat
+    [ "" : cMulConst (mulName c i) q
+    | (i, s) <- zip [0 :: Int ..] ss
+    , (c, q) <- [("a1", sectionQA1 s), ("a2", sectionQA2 s)]
+    ] ++ concat
+    [ "" : cMulConst (mulName "scale" 0) k
+    | Just (k, _) <- [designScale d]
+    ] ++
+    [ ""
+    , printf "static int16_t /* %s */ %s(%sint8_t /* 7:%d */ x) {"
+        outFormat (filterName spec) (if channels > 1 then "uint8_t ch, " else "") (filterInputFrac spec)
+    , "    static int16_t"
+    ] ++
+    [ printf "        /* 15:%d */ %s, %s%s" (sectionFrac s) (decl "d1" i) (decl "d2" i) (if i == n - 1 then ";" else ",")
+    | (i, s) <- zip [0 :: Int ..] ss
+    ] ++
+    [ printf "    static int16_t %s;" (decl "r" i) | i <- narrowed ] ++
+    [ "    int16_t u, y = x;" ] ++
+    [ "    int32_t t;" | not (null narrowed) ] ++ concat
+    [ [ ""
+      , printf "    // a1 = %.8f, a2 = %.8f" (sectionA1 s) (sectionA2 s)
+      ] ++ rescaleC i (sectionFrac s - frac) ++
+      [ printf "    y    = u + %s;" (var "d1" i)
+      , printf "    %s = ((int32_t) u << 1) - ((%s(y) + %d) >> %d) + %s;"
+            (var "d1" i) (mulName "a1" i) (bit (coefShift - 1) :: Integer) coefShift (var "d2" i)
+      , printf "    %s = u - ((%s(y) + %d) >> %d);"
+            (var "d2" i) (mulName "a2" i) (bit (coefShift - 1) :: Integer) coefShift
+      ]
+    | (i, s, frac) <- zip3 [0 :: Int ..] ss fracs
+    ] ++
+    [ ""
+    ] ++
+    [ if sh > 0
+        then printf "    y    = (%s(y) + %d) >> %d;" (mulName "scale" 0) (bit (sh - 1) :: Integer) sh
+        else printf "    y    = %s(y);" (mulName "scale" 0)
+    | Just (_, sh) <- [designScale d]
+    ] ++
+    [ "    return y;"
+    , "}"
+    ]
+    where
+        spec    = designSpec d
+        ss      = designSections d
+        n       = length ss
+        outFrac = sectionFrac (last ss)
+        channels = filterChannels spec
+        -- state variables: scalars, or arrays indexed by channel
+        var v i     = printf "%s_%d%s" (v :: String) (i :: Int) (if channels > 1 then "[ch]" else "") :: String
+        decl v i
+            | channels > 1  = printf "%s_%d[%d]" (v :: String) (i :: Int) channels :: String
+            | otherwise     = printf "%s_%d = 0" v i
+        outFormat = maybe (printf "15:%d" outFrac) (const "scaled") (designScale d) :: String
+        mulName c i = printf "%s_%s_%d" (filterName spec) (c :: String) i :: String
+        fracs   = filterInputFrac spec : map sectionFrac ss
+        -- sections with fewer fractional bits than their input
+        narrowed = [i | (i, s, frac) <- zip3 [0 :: Int ..] ss fracs, sectionFrac s < frac]
+        -- see rescale
+        rescaleC i k
+            | k > 0     = [printf "    u    = y << %d;" k]
+            | k < 0     =
+                [ printf "    t    = (int32_t) y + %s;" (var "r" i)
+                , printf "    u    = t >> %d;" (negate k)
+                , printf "    %s = t & %d;" (var "r" i) (bit (negate k) - 1 :: Integer)
+                ]
+            | otherwise = ["    u    = y;"]
+
+-- |A human-readable account of the design: coefficients, formats and
+-- headroom of each section, and the simulated quantization error.
+filterReport :: Design -> String
+filterReport d = unlines $
+    [ printf "%s: order-%d Butterworth low-pass, -3dB at %g Hz, %g Hz updates"
+        (filterName spec) (filterOrder spec) (filterCutoff spec) (filterRate spec)
+    , printf "input: int8 with %d fractional bits, std dev %g counts" (filterInputFrac spec) (filterInputSigma spec)
+    , printf "channels: %d" (filterChannels spec)
+    , "headroom: " ++ case filterHeadroom spec of
+        WorstCase   -> "worst case (no input can overflow)"
+        Sigmas k    -> printf "%g sigma" k
+    , ""
+    ] ++ concat
+    [ [ printf "section %d:" i
+      , printf "  a1 = %.8f -> %d / 2^%d (error %.2e)" (sectionA1 s) (sectionQA1 s) coefShift (sectionA1 s - fromInteger (sectionQA1 s) / 2 ^ coefShift)
+      , printf "  a2 = %.8f -> %d / 2^%d (error %.2e)" (sectionA2 s) (sectionQA2 s) coefShift (sectionA2 s - fromInteger (sectionQA2 s) / 2 ^ coefShift)
+      , printf "  state 15:%d, bound %.1f (%.1f of 32767 counts)" (sectionFrac s) (sectionBound s) (sectionBound s * 2 ^^ sectionFrac s)
+      , "  without MUL: a1 " ++ mulCost (sectionQA1 s) ++ ", a2 " ++ mulCost (sectionQA2 s)
+      ]
+    | (i, s) <- zip [0 :: Int ..] (designSections d)
+    ] ++
+    concat
+    [ [ ""
+      , printf "output scaled by %d / 2^%d = %.6f" k sh (fromInteger k / 2 ^^ sh :: Double)
+      , "  without MUL: " ++ mulCost k
+      ]
+    | Just (k, sh) <- [designScale d]
+    ] ++
+    [ ""
+    , printf "without MUL, the multiplies take about %d cycles per sample (4 per" (sum (map cycles consts))
+    , "32-bit add or 1-bit shift), instead of a libgcc __mulsi3 call each"
+    ] ++
+    [ ""
+    , "simulated with 40000 normally distributed inputs:"
+    , printf "  output std dev   %.1f counts" (designOutputSigma d)
+    , printf "  error vs float   %.2f counts rms, %.2f mean" (designErrorRMS d) (designErrorMean d)
+    , printf "  noise floor      %.1f dB below the output" (20 * logBase 10 (designOutputSigma d / max 1e-9 (designErrorRMS d)))
+    , printf "  overflows        %d" (designOverflows d)
+    ]
+    where
+        spec    = designSpec d
+        consts  = concat [[sectionQA1 s, sectionQA2 s] | s <- designSections d]
+                    ++ maybe [] (return . fst) (designScale d)
+        -- Horner order: one shift per bit of the top digit, and an add
+        -- per digit after the first
+        ops k       = case csd k of
+            []  -> (0, 0)
+            ds  -> (snd (head ds), length ds - 1)
+        cycles k    = let (sh, adds) = ops k in 4 * (sh + adds)
+        mulCost k   = let (sh, adds) = ops k
+                      in printf "%d digits, %d shifts + %d adds" (length (csd k)) sh adds
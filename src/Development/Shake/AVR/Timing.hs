@@ -0,0 +1,113 @@
+{-# LANGUAGE CPP #-}
+-- |Records how long each build step took, so the next run can start the
+-- slow ones first and report how well that worked out.
+module Development.Shake.AVR.Timing
+    ( timed
+    , recordedDuration
+    , reportMakespan
+    ) where
+
+import Control.Monad
+import Data.IORef
+import Data.List
+import Data.Time.Clock.POSIX
+import Development.Shake
+import Development.Shake.FilePath
+import GHC.Conc (getNumProcessors)
+import qualified System.Directory as IO
+import System.IO.Unsafe
+import Text.Printf
+
+data Timing = Timing
+    { timingStart       :: Double
+    , timingEnd         :: Double
+    , timingEstimate    :: Maybe Double
+    } deriving (Show, Read)
+
+timingDuration :: Timing -> Double
+timingDuration t = timingEnd t - timingStart t
+
+-- kept out of the build tree, so the estimates survive a "clean" and
+-- are there when they matter most: on the next cold build.  The output
+-- path is flattened into a single file name.
+timingFile :: FilePath -> FilePath
+timingFile out = ".avr-shake" </> "timing" </> concatMap escape out
+    where
+        escape '%'  = "%%"
+        escape c
+            | isPathSeparator c || c == ':' = "%_"
+            | otherwise                     = [c]
+
+readTiming :: FilePath -> IO (Maybe Timing)
+readTiming out = do
+    exists <- IO.doesFileExist (timingFile out)
+    if not exists then return Nothing else do
+        str <- readFile (timingFile out)
+        length str `seq` return $ case reads str of
+            [(t, _)]    -> Just t
+            _           -> Nothing
+
+now :: IO Double
+now = fmap realToFrac getPOSIXTime
+
+-- Time at which this process first ran a timed step; records that
+-- started earlier than this come from a previous run.
+runStarted :: IORef (Maybe Double)
+runStarted = unsafePerformIO (newIORef Nothing)
+{-# NOINLINE runStarted #-}
+
+-- |Run a step that produces 'out', recording how long it took.  If a
+-- previous run recorded a duration, the step is first rescheduled with
+-- that duration as its priority so that long jobs (the ones likely to
+-- be on the critical path) get a thread before short ones.
+timed :: FilePath -> Action a -> Action a
+timed out act = do
+    previous <- liftIO (readTiming out)
+    let estimate = fmap timingDuration previous
+    maybe (return ()) prioritize estimate
+
+    start <- liftIO now
+    liftIO (atomicModifyIORef runStarted (\s -> (Just (maybe start (min start) s), ())))
+    result <- act
+    end <- liftIO now
+    liftIO $ do
+        IO.createDirectoryIfMissing True (takeDirectory (timingFile out))
+        writeFile (timingFile out) (show (Timing start end estimate))
+    return result
+
+-- |How long the last timed step producing 'out' took, if it's been run.
+recordedDuration :: FilePath -> Action (Maybe Double)
+recordedDuration out = liftIO (fmap (fmap timingDuration) (readTiming out))
+
+prioritize :: Double -> Action ()
+#if MIN_VERSION_shake(0,17,0)
+prioritize = reschedule
+#else
+prioritize _ = return ()
+#endif
+
+-- |Compare the makespan of the timed steps for 'outs' that ran in this
+-- build against the makespan predicted from the previous durations
+-- (longest-first list scheduling over shake's thread count).  Says
+-- nothing unless every one of them was rebuilt with an estimate.
+reportMakespan :: [FilePath] -> Action ()
+reportMakespan outs = do
+    started <- liftIO (readIORef runStarted)
+    timings <- liftIO (mapM readTiming outs)
+    threads <- shakeThreads `fmap` getShakeOptions
+    nCaps   <- liftIO getNumProcessors
+    let n = if threads > 0 then threads else nCaps
+        current = [t | Just t <- timings, Just s <- [started], timingStart t >= s]
+        estimates = [e | Just e <- map timingEstimate current]
+    when (not (null outs) && length estimates == length outs) $ do
+        let actual      = maximum (map timingEnd current) - minimum (map timingStart current)
+            predicted   = listSchedule n estimates
+        putNormal $ printf "%d jobs on %d threads: predicted makespan %.2fs, actual %.2fs"
+            (length outs) n predicted actual
+
+-- longest-processing-time-first list scheduling
+listSchedule :: Int -> [Double] -> Double
+listSchedule n = maximum . foldl' assign (replicate (max 1 n) 0) . sortBy (flip compare)
+    where
+        assign (free : busy) job = insert (free + job) busy
+        assign [] _ = []
@@ -0,0 +1,186 @@
+-- |A minimal remote compile protocol: a client sends a compiler name,
+-- flags and an already-preprocessed C source over a unix or TCP socket,
+-- and a worker compiles it and sends back the exit code, diagnostics and
+-- object file (or, if it won't run that compiler, a refusal, and the
+-- client tries elsewhere).  Since the source is preprocessed, workers
+-- need the compiler but none of the project's headers.
+module System.Command.CompileWorker
+    ( Backend
+    , localOnly
+    , workerBackend
+    , serveCompiles
+    ) where
+
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import qualified Data.ByteString as BS
+import qualified Data.ByteString.Char8 as BS8
+import Data.Char
+import Data.IORef
+import Network.Socket
+import System.Directory
+import System.Exit
+import System.FilePath
+import System.IO
+import System.IO.Unsafe
+import System.Process
+import System.Timeout
+
+-- |A compile backend takes a compiler, flags and preprocessed source and
+-- returns the exit code, stderr and object file contents, or Nothing if
+-- it couldn't run the job at all (in which case the caller compiles
+-- locally).
+type Backend = String -> [String] -> BS.ByteString -> IO (Maybe (ExitCode, String, BS.ByteString))
+
+localOnly :: Backend
+localOnly _ _ _ = return Nothing
+
+-- |Send jobs to the workers listening on the given sockets, spreading
+-- them round-robin and moving on to the next worker if one can't be
+-- reached, refuses the compiler or doesn't answer within
+-- 'workerTimeout'.  A worker is a unix socket path, or "host:port" for
+-- TCP.
+workerBackend :: [String] -> Backend
+workerBackend [] _ _ _ = return Nothing
+workerBackend workers cc flags src = do
+    n <- atomicModifyIORef nextWorker (\i -> (i + 1, i))
+    let (after, before) = splitAt (n `mod` length workers) workers
+    tryWorkers (before ++ after)
+    where
+        tryWorkers [] = return Nothing
+        tryWorkers (w:ws) = do
+            result <- try (compileOn w cc flags src)
+            case result of
+                Right (Just r)              -> return (Just r)
+                Right Nothing               -> tryWorkers ws
+                Left (SomeException _)      -> tryWorkers ws
+
+nextWorker :: IORef Int
+nextWorker = unsafePerformIO (newIORef 0)
+{-# NOINLINE nextWorker #-}
+
+-- |Seconds a worker gets to take a job, compile it and send back the
+-- result before the client gives up on it (and a worker gets to receive
+-- a job before it gives up on the client).
+workerTimeout :: Int
+workerTimeout = 300
+
+-- "host:port" (or "[host]:port", or ":port" for any host when listening)
+-- is a TCP address; anything else is a unix socket path
+resolve :: [AddrInfoFlag] -> String -> IO (Family, SockAddr)
+resolve flags worker = case break (== ':') (reverse worker) of
+    (port@(_:_), ':' : host) | all isDigit port && '/' `notElem` worker -> do
+        let hints = defaultHints { addrFlags = flags, addrSocketType = Stream }
+        info : _ <- getAddrInfo (Just hints) (hostName (reverse host)) (Just (reverse port))
+        return (addrFamily info, addrAddress info)
+    _ -> return (AF_UNIX, SockAddrUnix worker)
+    where
+        hostName ""                                 = Nothing
+        hostName ('[' : h@(_:_)) | last h == ']'    = Just (init h)
+        hostName h                                  = Just h
+
+connectTo :: String -> IO Handle
+connectTo worker = do
+    (family, addr) <- resolve [] worker
+    sock <- socket family Stream defaultProtocol
+    connect sock addr `onException` close sock
+    h <- socketToHandle sock ReadWriteMode
+    hSetBinaryMode h True
+    return h
+
+-- the reply is 'Nothing' if the worker refused the compiler, otherwise
+-- the exit code and diagnostics, followed by the object file; it's also
+-- 'Nothing' if the whole exchange takes longer than 'workerTimeout'
+compileOn :: String -> String -> [String] -> BS.ByteString -> IO (Maybe (ExitCode, String, BS.ByteString))
+compileOn worker cc flags src = fmap join $ timeout (workerTimeout * 1000000) $
+    bracket (connectTo worker) hClose $ \h -> do
+        putFrame h (BS8.pack (show (cc, flags)))
+        putFrame h src
+        hFlush h
+        reply <- fmap (read . BS8.unpack) (getFrame h)
+        case reply of
+            Nothing             -> return Nothing
+            Just (code, err)    -> do
+                obj <- getFrame h
+                return (Just (decodeExit code, err, obj))
+
+-- frames are a decimal length on a line of its own, then that many bytes
+putFrame :: Handle -> BS.ByteString -> IO ()
+putFrame h bytes = do
+    hPutStr h (show (BS.length bytes) ++ "\n")
+    BS.hPut h bytes
+
+getFrame :: Handle -> IO BS.ByteString
+getFrame h = do
+    n <- fmap read (hGetLine h)
+    bytes <- BS.hGet h n
+    when (BS.length bytes /= n) (fail "compile worker: connection closed mid-frame")
+    return bytes
+
+encodeExit :: ExitCode -> Int
+encodeExit ExitSuccess      = 0
+encodeExit (ExitFailure n)  = n
+
+decodeExit :: Int -> ExitCode
+decodeExit 0 = ExitSuccess
+decodeExit n = ExitFailure n
+
+-- |Run a compile worker on the given unix socket (or TCP "host:port",
+-- as for 'workerBackend'), running at most 'jobs' compiles at once and
+-- refusing any compiler not in 'compilers'.  This is what the
+-- avr-shake-worker executable does; it's meant to be started once per
+-- host (or container) with the socket somewhere the build can reach.
+-- Workers trust their clients' flags, so only share the socket with
+-- builds that could run the compiler themselves: a TCP worker accepts
+-- anyone who can reach its port, so only listen on a trusted network.
+serveCompiles :: [String] -> Int -> String -> IO ()
+serveCompiles compilers jobs worker = do
+    (family, addr) <- resolve [AI_PASSIVE] worker
+    case addr of
+        SockAddrUnix path   -> do
+            exists <- doesFileExist path
+            when exists (removeFile path)
+        _                   -> return ()
+    sock <- socket family Stream defaultProtocol
+    when (family /= AF_UNIX) (setSocketOption sock ReuseAddr 1)
+    bind sock addr
+    listen sock 16
+    slots <- newQSem (max 1 jobs)
+    forever $ do
+        (conn, _) <- accept sock
+        h <- socketToHandle conn ReadWriteMode
+        hSetBinaryMode h True
+        forkIO $ handle (\(SomeException _) -> return ()) $
+            bracket_ (waitQSem slots) (signalQSem slots) (serveJob compilers h) `finally` hClose h
+
+serveJob :: [String] -> Handle -> IO ()
+serveJob compilers h = do
+    job <- timeout (workerTimeout * 1000000) $ do
+        (cc, flags) <- fmap (read . BS8.unpack) (getFrame h)
+        src <- getFrame h
+        return (cc, flags, src)
+    case job of
+        Nothing                 -> return ()
+        Just (cc, flags, src)
+            | cc `elem` compilers   -> compile cc flags src
+            | otherwise             -> do
+                putFrame h (BS8.pack (show (Nothing :: Maybe (Int, String))))
+                hFlush h
+    where
+        compile cc flags src = do
+            tmp <- getTemporaryDirectory
+            bracket (openBinaryTempFile tmp "avr-shake.i") (cleanup . fst) $ \(srcFile, srcH) -> do
+                BS.hPut srcH src
+                hClose srcH
+                let objFile = srcFile `replaceExtension` "o"
+                (code, _, err) <- readProcessWithExitCode cc (flags ++ ["-c", srcFile, "-o", objFile]) ""
+                obj <- case code of
+                    ExitSuccess -> BS.readFile objFile `finally` cleanup objFile
+                    _           -> return BS.empty
+                putFrame h (BS8.pack (show (Just (encodeExit code, err :: String))))
+                putFrame h obj
+                hFlush h
+        cleanup file = do
+            exists <- doesFileExist file
+            when exists (removeFile file)
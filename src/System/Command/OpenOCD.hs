@@ -0,0 +1,146 @@
+{-# LANGUAGE GeneralizedNewtypeDeriving #-}
+module System.Command.OpenOCD
+    ( ResetMode(..)
+    , ImageType(..)
+    , ScriptM
+    , Script
+    , raw
+    , initialize
+    , reset
+    , flashProbe
+    , writeImage, writeImageErase
+    , verifyImage
+    , shutdown
+    , encodeScript
+    , scriptFiles
+    , changedRuns
+    , openocd
+    ) where
+
+import Control.Applicative
+import Control.Monad.Writer
+import qualified Data.ByteString as BS
+import System.Exit
+import System.Process
+
+data ResetMode = Run | Halt | Init
+
+encodeResetMode :: ResetMode -> String
+encodeResetMode Run     = "run"
+encodeResetMode Halt    = "halt"
+encodeResetMode Init    = "init"
+
+data ImageType
+    = BinImage
+    | IHexImage
+    | ElfImage
+    | S19Image
+    | AutoImage
+
+encodeImageType :: ImageType -> [String]
+encodeImageType BinImage    = ["bin"]
+encodeImageType IHexImage   = ["ihex"]
+encodeImageType ElfImage    = ["elf"]
+encodeImageType S19Image    = ["s19"]
+encodeImageType AutoImage   = []
+
+data Command
+    = Raw           String
+    | WriteImage    Bool FilePath Integer ImageType
+    | VerifyImage   FilePath Integer ImageType
+
+encodeCommand :: Command -> String
+encodeCommand (Raw cmd) = cmd
+encodeCommand (WriteImage erase file offset ty) = unwords $
+    ["flash", "write_image"] ++ ["erase" | erase]
+        ++ [encodeFile file, show offset] ++ encodeImageType ty
+encodeCommand (VerifyImage file offset ty) = unwords $
+    ["verify_image", encodeFile file, show offset] ++ encodeImageType ty
+
+-- openocd commands are Tcl, so anything unusual in a file name
+-- needs to be braced to get through as a single word.
+encodeFile :: FilePath -> String
+encodeFile file
+    | any (`elem` " \t{}[]$;\"\\") file = "{" ++ file ++ "}"
+    | otherwise                         = file
+
+commandFile :: Command -> Maybe FilePath
+commandFile (WriteImage _ file _ _) = Just file
+commandFile (VerifyImage  file _ _) = Just file
+commandFile _                       = Nothing
+
+newtype ScriptM t = ScriptM (Writer [Command] t)
+    deriving (Monad, Functor, Applicative)
+
+type Script = ScriptM ()
+
+instance Monoid t => Monoid (ScriptM t) where
+    mempty  = pure mempty
+    mappend = liftA2 mappend
+
+runScript :: Script -> [Command]
+runScript (ScriptM x) = execWriter x
+
+emit :: Command -> Script
+emit cmd = ScriptM (tell [cmd])
+
+raw :: String -> Script
+raw = emit . Raw
+
+initialize :: Script
+initialize = raw "init"
+
+reset :: ResetMode -> Script
+reset mode = raw ("reset " ++ encodeResetMode mode)
+
+flashProbe :: Int -> Script
+flashProbe bank = raw ("flash probe " ++ show bank)
+
+writeImage :: FilePath -> Integer -> ImageType -> Script
+writeImage file offset ty = emit (WriteImage False file offset ty)
+
+-- |Like 'writeImage', but has openocd erase exactly the sectors the
+-- image touches first (rather than relying on a prior chip erase).
+writeImageErase :: FilePath -> Integer -> ImageType -> Script
+writeImageErase file offset ty = emit (WriteImage True file offset ty)
+
+verifyImage :: FilePath -> Integer -> ImageType -> Script
+verifyImage file offset ty = emit (VerifyImage file offset ty)
+
+shutdown :: Script
+shutdown = raw "shutdown"
+
+encodeScript :: Script -> [String]
+encodeScript script = concat [["-c", encodeCommand cmd] | cmd <- runScript script]
+
+scriptFiles :: Script -> [FilePath]
+scriptFiles script = [file | Just file <- map commandFile (runScript script)]
+
+-- |Given a sector size and the new and previous contents of a raw flash
+-- image, compute the runs of consecutive sectors that differ as
+-- (offset, contents) pairs.  Sectors past the end of the new image are
+-- never reported; whatever is left there is not referenced by it.
+changedRuns :: Int -> BS.ByteString -> BS.ByteString -> [(Int, BS.ByteString)]
+changedRuns sectorSize new old = map merge (contiguous changed)
+    where
+        sectorAt img i = BS.take sectorSize (BS.drop (i * sectorSize) img)
+        nSectors = (BS.length new + sectorSize - 1) `div` sectorSize
+        changed =
+            [ i
+            | i <- [0 .. nSectors - 1]
+            , sectorAt new i /= sectorAt old i
+            ]
+        
+        contiguous [] = []
+        contiguous (i:is) = (i : map fst run) : contiguous (map fst rest)
+            where (run, rest) = span (uncurry (==)) (zip is [i + 1 ..])
+        
+        merge run@(start:_) =
+            ( start * sectorSize
+            , BS.take (length run * sectorSize) (BS.drop (start * sectorSize) new)
+            )
+        merge [] = error "changedRuns: empty run"
+
+openocd :: [FilePath] -> Script -> IO ExitCode
+openocd cfgs script = rawSystem "openocd"
+    (concat [["-f", cfg] | cfg <- cfgs] ++ encodeScript (script >> shutdown))
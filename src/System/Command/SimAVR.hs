@@ -0,0 +1,45 @@
+-- |Running firmware under simavr's run_avr with signals traced to a VCD
+-- file.  run_avr has no notion of a run length, so it's simply stopped
+-- after a given (wall clock) time; it writes out the VCD on SIGTERM.
+module System.Command.SimAVR
+    ( Trace(..)
+    , encodeTrace
+    , simavr
+    ) where
+
+import Control.Concurrent
+import Control.Exception
+import System.Exit
+import System.Process
+import Text.Printf
+
+data Trace
+    = PinTrace      !String !Integer !Integer
+        -- ^ name, address of the port's PORTx register, pin mask
+    | RegisterTrace !String !Integer !Integer
+        -- ^ name, data-space address, mask; traces every write
+    | IRQTrace      !String !Integer !Integer
+        -- ^ name, vector number (as address), mask
+
+encodeTrace :: Trace -> [String]
+encodeTrace (PinTrace      name addr mask) = ["--add-trace", printf "%s=portpin@0x%02x/0x%02x" name addr mask]
+encodeTrace (RegisterTrace name addr mask) = ["--add-trace", printf "%s=trace@0x%02x/0x%02x"   name addr mask]
+encodeTrace (IRQTrace      name addr mask) = ["--add-trace", printf "%s=irq@0x%02x/0x%02x"     name addr mask]
+
+-- |'simavr runAvr mcu freq opts traces seconds elf vcd' runs 'elf' for
+-- 'seconds' and leaves the traced signals in 'vcd'.
+simavr :: FilePath -> String -> Integer -> [String] -> [Trace] -> Double -> FilePath -> FilePath -> IO ()
+simavr runAvr mcu freq opts traces seconds elf vcd = do
+    let args = ["-m", mcu, "-f", show freq, "-o", vcd]
+            ++ opts ++ concatMap encodeTrace traces ++ [elf]
+    (_, _, _, p) <- createProcess (proc runAvr args)
+    exited <- newEmptyMVar
+    _ <- forkIO (waitForProcess p >>= putMVar exited)
+    _ <- forkIO (threadDelay (round (seconds * 1e6)) >> terminateProcess p)
+    code <- takeMVar exited `onException` terminateProcess p
+    case code of
+        -- killed by our SIGTERM, which is the normal way for a run to end
+        ExitFailure n | n `elem` [-15, 143]
+                        -> return ()
+        ExitSuccess     -> return ()
+        ExitFailure n   -> fail (runAvr ++ " exited with code " ++ show n)
@@ -0,0 +1,103 @@
+-- |Test of Data.AVR.Capture against pseudo-terminals: chunks written
+-- into the master ends, a known time apart, have to come out of a
+-- capture of the slave ends byte for byte, each timestamped between
+-- its own write and the next, and the index has to find them by time.
+module Main where
+
+import Control.Concurrent
+import Control.Exception
+import Control.Monad
+import Data.AVR.Capture
+import qualified Data.ByteString as BS
+import qualified Data.ByteString.Char8 as BS8
+import Data.IORef
+import Data.Word
+import System.Clock
+import System.Directory
+import System.Exit
+import System.FilePath
+import System.IO
+import System.Posix.IO
+import System.Posix.Terminal
+
+-- (port, bytes), written 'gap' seconds apart
+writes =
+    [ (0, BS8.pack "hello")
+    , (1, BS8.pack "world")
+    , (0, BS.pack [0 .. 255])       -- raw mode mustn't translate any of it
+    , (1, BS.replicate 2000 0x55)
+    , (0, BS8.pack "end\r\n")
+    ]
+
+gap = 0.1 :: Double
+
+now :: IO Word64
+now = fmap (fromInteger . toNanoSecs) (getTime Monotonic)
+
+chunkKey c = (chunkPort c, chunkTime c, chunkData c)
+
+main = do
+    failures <- newIORef (0 :: Int)
+    let check name ok = unless ok $ do
+            putStrLn ("FAIL: " ++ name)
+            modifyIORef failures (+ 1)
+    
+    ptys    <- replicateM 2 openPseudoTerminal
+    names   <- mapM (getSlaveTerminalName . fst) ptys
+    forM_ names $ \name -> configurePort name 115200
+    masters <- mapM (fdToHandle . fst) ptys
+    forM_ masters $ \h -> hSetBuffering h NoBuffering
+    
+    tmp <- getTemporaryDirectory
+    let out = tmp </> "avr-shake-capture-test.cap"
+    done <- newEmptyMVar
+    _ <- forkIO $ capture names (gap * fromIntegral (length writes + 4)) out
+        `finally` putMVar done ()
+    
+    -- give the readers time to start
+    threadDelay (round (2 * gap * 1e6))
+    times <- forM writes $ \(port, bytes) -> do
+        t <- now
+        BS.hPut (masters !! port) bytes
+        threadDelay (round (gap * 1e6))
+        return t
+    takeMVar done
+    
+    Capture ports chunks <- readCapture out
+    check "port names" (ports == names)
+    check "records in time order" $
+        and (zipWith (<=) (map chunkTime chunks) (map chunkTime (drop 1 chunks)))
+    forM_ (zip3 [0 :: Int ..] writes (zip times (drop 1 times ++ [maxBound]))) $
+        \(i, (port, bytes), (from, to)) -> check ("write " ++ show i ++ " recorded between it and the next") $
+            BS.concat [chunkData c | c <- chunks, from <= chunkTime c, chunkTime c < to] == bytes
+                && all ((== port) . chunkPort) [c | c <- chunks, from <= chunkTime c, chunkTime c < to]
+    
+    bytes <- BS.readFile out
+    check "index written" (BS8.pack "AVRCIDX1" `BS.isSuffixOf` bytes)
+    
+    Capture _ ranged <- readCaptureRange (times !! 2) (times !! 3) out
+    check "index finds a write by time" (BS.concat (map chunkData ranged) == snd (writes !! 2))
+    
+    -- a capture killed before writing its index, and one killed
+    -- mid-record: readers scan, and drop the partial record
+    let records     = BS.take (BS.length bytes - 20 - 16 * length chunks) bytes
+        unindexed   = out ++ ".unindexed"
+        truncated   = out ++ ".truncated"
+    BS.writeFile unindexed records
+    BS.writeFile truncated (BS.take (BS.length records - 1) records)
+    
+    Capture _ scanned <- readCapture unindexed
+    check "scanned without an index" (map chunkKey scanned == map chunkKey chunks)
+    Capture _ scannedRange <- readCaptureRange (times !! 2) (times !! 3) unindexed
+    check "range scanned without an index" (map chunkKey scannedRange == map chunkKey ranged)
+    Capture _ partial <- readCapture truncated
+    check "partial last record dropped" (map chunkKey partial == map chunkKey (init chunks))
+    
+    mapM_ removeFile [out, unindexed, truncated]
+    mapM_ hClose masters
+    mapM_ (closeFd . snd) ptys
+    
+    n <- readIORef failures
+    if n == 0
+        then putStrLn "capture: all checks passed"
+        else exitFailure
@@ -0,0 +1,136 @@
+-- |Tests of openocd_flash' and the System.Command.OpenOCD pieces it's
+-- built from.  openocd itself is replaced by openocd-stub (in this
+-- directory), which logs the commands it's given and keeps the
+-- "device's" flash in a file; run from the package's root directory.
+module Main where
+
+import Control.Exception
+import Control.Monad
+import qualified Data.ByteString as BS
+import qualified Data.ByteString.Char8 as BC
+import Data.IORef
+import Data.List
+import Development.Shake
+import Development.Shake.AVR hiding (action)
+import Development.Shake.FilePath
+import System.Command.OpenOCD (changedRuns, encodeScript)
+import qualified System.Directory as IO
+import System.Exit
+
+sector  = 16
+base    = 0x1000 :: Integer
+
+-- 5 sectors
+image0 = BS.pack (map fromIntegral [0 .. 79 :: Int])
+
+-- change the bytes at the given offsets
+poke offsets img = BS.pack
+    [ if i `elem` offsets then b + 1 else b
+    | (i, b) <- zip [0 :: Int ..] (BS.unpack img)
+    ]
+
+slice offset len = BS.take len . BS.drop offset
+
+main = do
+    failures <- newIORef (0 :: Int)
+    let check name ok = unless ok $ do
+            putStrLn ("FAIL: " ++ name)
+            modifyIORef failures (+ 1)
+    
+    checkChangedRuns check
+    checkScript check
+    checkFlash check
+    
+    n <- readIORef failures
+    if n == 0
+        then putStrLn "openocd: all checks passed"
+        else exitFailure
+
+checkChangedRuns check = do
+    check "changedRuns: identical images"
+        (null (changedRuns sector image0 image0))
+    check "changedRuns: nothing flashed before"
+        (changedRuns sector image0 BS.empty == [(0, image0)])
+    check "changedRuns: separate sectors"
+        (changedRuns sector image0 (poke [20, 50] image0)
+            == [(16, slice 16 16 image0), (48, slice 48 16 image0)])
+    check "changedRuns: neighbouring sectors merge"
+        (changedRuns sector image0 (poke [20, 40] image0) == [(16, slice 16 32 image0)])
+    check "changedRuns: image grown"
+        (changedRuns sector image0 (BS.take 40 image0) == [(32, BS.drop 32 image0)])
+    check "changedRuns: image shrunk, only its last partial sector rewritten"
+        (changedRuns sector (BS.take 40 image0) image0 == [(32, slice 32 8 image0)])
+
+checkScript check =
+    check "encodeScript" $ encodeScript script ==
+        [ "-c", "init"
+        , "-c", "reset init"
+        , "-c", "flash probe 0"
+        , "-c", "flash write_image erase {a b.bin} 4112 bin"
+        , "-c", "verify_image img.bin 4096 bin"
+        ]
+    where
+        script = do
+            initialize
+            reset Init
+            flashProbe 0
+            writeImageErase "a b.bin" 0x1010 BinImage
+            verifyImage "img.bin" 0x1000 BinImage
+
+checkFlash check = do
+    stub <- IO.canonicalizePath ("test" </> "openocd-stub")
+    tmp  <- getTemporaryDirectory
+    let dir = tmp </> "avr-shake-openocd-test"
+    exists <- IO.doesDirectoryExist dir
+    when exists (IO.removeDirectoryRecursive dir)
+    IO.createDirectory dir
+    IO.setCurrentDirectory dir
+    
+    writeFile "device.base" (show base)
+    BS.writeFile "device.bin" BS.empty
+    
+    let img     = "image.bin"
+        opts    = shakeOptions { shakeFiles = ".shake", shakeVerbosity = Quiet }
+        flash contents = do
+            BS.writeFile img contents
+            BS.writeFile "openocd.log" BS.empty
+            shake opts (action (openocd_flash' stub [] (return ()) sector base img))
+            fmap (lines . BC.unpack) (BS.readFile "openocd.log")
+        writes  = filter ("flash write_image" `isPrefixOf`)
+        verify  = "verify_image image.bin 4096 bin"
+        device  = BS.readFile "device.bin"
+        parts   = fmap (filter (".part" `isInfixOf`)) (IO.getDirectoryContents ".")
+    
+    log1 <- flash image0
+    check "first flash writes everything"
+        (writes log1 == ["flash write_image erase image.bin.part0 4096 bin"])
+    device >>= check "first flash: device matches" . (== image0)
+    
+    let image1 = poke [20] image0
+    log2 <- flash image1
+    check "one sector changed: only it is written"
+        (writes log2 == ["flash write_image erase image.bin.part0 4112 bin"])
+    check "one sector changed: whole image verified" (verify `elem` log2)
+    parts >>= check "part files removed" . null
+    
+    log3 <- flash image1
+    check "up to date: nothing written, still verified"
+        (null (writes log3) && verify `elem` log3)
+    
+    -- another board, or another tool: the record no longer describes
+    -- the device, so the whole image has to go
+    BS.writeFile "device.bin" (BS.replicate 80 0)
+    let image2 = poke [70] image1
+    log4 <- flash image2
+    check "stale device: whole image written after the verify fails"
+        (writes log4 ==
+            [ "flash write_image erase image.bin.part0 4160 bin"
+            , "flash write_image erase image.bin 4096 bin"
+            ])
+    device >>= check "stale device: device matches" . (== image2)
+    
+    writeFile "device.fail" ""
+    result <- try (flash (poke [5] image2)) :: IO (Either SomeException [String])
+    check "openocd failing fails the build" (either (const True) (const False) result)
+    parts >>= check "openocd failing: part files removed" . null
+    IO.removeFile "device.fail"
@@ -0,0 +1,22 @@
+-- Compile worker for Development.Shake.AVR's avr_gcc_with: listens on a
+-- unix socket (or TCP "host:port") and compiles preprocessed sources
+-- sent by shake builds.
+module Main where
+
+import GHC.Conc (getNumProcessors)
+import System.Command.CompileWorker
+import System.Environment
+import System.Exit
+import System.IO
+
+defaultCompilers = ["avr-gcc", "arm-none-eabi-gcc"]
+
+main = do
+    args <- getArgs
+    case args of
+        [path]                  -> getNumProcessors >>= \jobs -> serveCompiles defaultCompilers jobs path
+        [path, jobs]            -> serveCompiles defaultCompilers (read jobs) path
+        path : jobs : compilers -> serveCompiles compilers (read jobs) path
+        _                       -> do
+            hPutStrLn stderr "usage: avr-shake-worker <socket or host:port> [jobs [compiler ...]]"
+            exitFailure